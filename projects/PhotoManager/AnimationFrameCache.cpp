@@ -0,0 +1,156 @@
+#include "AnimationFrameCache.h"
+#include <QMutexLocker>
+#include <QPainter>
+#include <QtConcurrent>
+#include "ImageScaler.h"
+
+bool AnimationFrameCache::RenderState::operator==(const RenderState& other) const
+{
+	return size == other.size && sourceRect == other.sourceRect && transform == other.transform && isRotated == other.isRotated
+		&& isSmooth == other.isSmooth && useKernel == other.useKernel && format == other.format;
+}
+
+AnimationFrameCache::~AnimationFrameCache()
+{
+	{
+		QMutexLocker locker(&mutex);
+		isStopping = true;
+	}
+	prefetchFuture.waitForFinished();
+}
+
+void AnimationFrameCache::setRenderState(const ImageHandle& image, const RenderState& state)
+{
+	QMutexLocker locker(&mutex);
+	if (image == cacheImage && state == cacheState)
+		return;
+
+	cacheImage = image;
+	cacheState = state;
+	cacheFrames.clear();
+	cacheGeneration++;
+}
+
+void AnimationFrameCache::clear()
+{
+	QMutexLocker locker(&mutex);
+	cacheImage.clear();
+	cacheFrames.clear();
+	cacheGeneration++;
+}
+
+AnimationFrameCache::Frame AnimationFrameCache::frame(int index)
+{
+	QMutexLocker locker(&mutex);
+	playbackIndex = index;
+
+	// Frames behind playback are not needed until animation loops
+	for (auto it = cacheFrames.begin(); it != cacheFrames.end();) {
+		if (isKept(it.key()))
+			++it;
+		else
+			it = cacheFrames.erase(it);
+	}
+	startPrefetch();
+	return cacheFrames.value(index);
+}
+
+AnimationFrameCache::Frame AnimationFrameCache::render(int index, const QImage& decoded, int delay)
+{
+	QMutexLocker locker(&mutex);
+	const RenderState state = cacheState;
+	const int generation = cacheGeneration;
+	locker.unlock();
+
+	Frame frame;
+	frame.decoded = decoded;
+	frame.prepared = renderFrame(decoded, state);
+	frame.delay = delay;
+
+	locker.relock();
+	if (generation == cacheGeneration && isKept(index))
+		cacheFrames.insert(index, frame);
+	return frame;
+}
+
+QImage AnimationFrameCache::renderFrame(const QImage& frame, const RenderState& state)
+{
+	if (frame.isNull())
+		return QImage();
+
+	if (state.isRotated) {
+		QImage prepared(state.size, state.format);
+		prepared.fill(Qt::transparent);
+		QPainter painter(&prepared);
+		painter.setRenderHint(QPainter::SmoothPixmapTransform, state.isSmooth);
+		painter.setTransform(state.transform);
+		painter.drawImage(0, 0, frame);
+		return prepared;
+	}
+
+	const QImage clipped = ImageScaler::subImage(frame, state.sourceRect);
+	QImage prepared;
+	if (state.isSmooth && state.useKernel)
+		prepared = ImageScaler::scaled(clipped, state.size);
+	else
+		prepared = clipped.scaled(state.size, Qt::IgnoreAspectRatio, state.isSmooth ? Qt::SmoothTransformation : Qt::FastTransformation);
+
+	// Area not needing scaling comes back unchanged, view into frame pixels must not outlive the frame
+	if (clipped.cacheKey() != frame.cacheKey() && prepared.constBits() == clipped.constBits())
+		prepared = clipped.copy();
+
+	// Painter converts grayscale on every repaint, prepared frame is converted once
+	if (prepared.format() == QImage::Format_Grayscale8)
+		prepared.convertTo(QImage::Format_RGB32);
+	return prepared;
+}
+
+bool AnimationFrameCache::isKept(int index) const
+{
+	const int frameCount = cacheImage ? cacheImage->frameCount() : 0;
+	if (frameCount == 0)
+		return false;
+
+	// Animations loop, frames at the start follow the last one
+	return (index - playbackIndex + frameCount) % frameCount < Capacity;
+}
+
+void AnimationFrameCache::startPrefetch()
+{
+	if (isPrefetchRunning || isStopping || !cacheImage)
+		return;
+	isPrefetchRunning = true;
+	prefetchFuture = QtConcurrent::run([this]() { prefetch(); });
+}
+
+void AnimationFrameCache::prefetch()
+{
+	QMutexLocker locker(&mutex);
+	while (!isStopping && cacheImage) {
+		// Nearest missing frame after the displayed one, playback moves on while frames are rendered
+		const int frameCount = cacheImage->frameCount();
+		int index = -1;
+		for (int i = 1; i < qMin(Capacity, frameCount); i++) {
+			const int candidate = (playbackIndex + i) % frameCount;
+			if (!cacheFrames.contains(candidate)) {
+				index = candidate;
+				break;
+			}
+		}
+		if (index < 0)
+			break;
+
+		const ImageHandle image = cacheImage;
+		const RenderState state = cacheState;
+		const int generation = cacheGeneration;
+		locker.unlock();
+		Frame frame;
+		frame.decoded = image->frame(index);
+		frame.delay = image->frameDelay(index);
+		frame.prepared = renderFrame(frame.decoded, state);
+		locker.relock();
+		if (generation == cacheGeneration && isKept(index))
+			cacheFrames.insert(index, frame);
+	}
+	isPrefetchRunning = false;
+}
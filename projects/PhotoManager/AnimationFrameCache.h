@@ -0,0 +1,75 @@
+#pragma once
+
+#include <QImage>
+#include <QHash>
+#include <QMutex>
+#include <QFuture>
+#include <QTransform>
+#include "Image.h"
+
+// Frames of animation scaled for display. Frames following the displayed one are decoded and rendered ahead on
+// a thread pool thread, so that playback only swaps prepared frames. Frames are kept for one render state,
+// changing zoom, viewport or rotation drops them.
+class AnimationFrameCache
+{
+public:
+	// Number of prepared frames kept, starting at the displayed one
+	static const int Capacity = 8;
+
+	// How decoded frame becomes prepared frame
+	struct RenderState
+	{
+		QSize size; // Size of prepared frame
+		QRect sourceRect; // Area of frame scaled to size, used without rotation
+		QTransform transform; // Frame to prepared frame, used with rotation
+		bool isRotated = false;
+		bool isSmooth = false;
+		bool useKernel = true; // Own downscaling kernel instead of QImage::scaled
+		QImage::Format format = QImage::Format_RGB32; // Format of prepared frame with rotation
+
+		bool operator==(const RenderState& other) const;
+	};
+
+	// Prepared frame together with the decoded frame and delay it belongs to, so that playback does not need the frame sequence
+	struct Frame
+	{
+		QImage decoded;
+		QImage prepared;
+		int delay = -1; // Delay to the next frame in ms
+	};
+
+	AnimationFrameCache() = default;
+	~AnimationFrameCache();
+
+	// Frames of image are rendered with state from now on, prepared frames are dropped when either changed
+	void setRenderState(const ImageHandle& image, const RenderState& state);
+
+	// Drop all prepared frames
+	void clear();
+
+	// Returns frame prepared ahead at index, null images when it is not prepared yet.
+	// Frames following index are prepared in the background.
+	Frame frame(int index);
+
+	// Renders decoded frame at index on the calling thread and keeps it, used when frame was not prepared ahead
+	Frame render(int index, const QImage& decoded, int delay);
+
+	// Returns frame rendered with state, safe to call from any thread
+	static QImage renderFrame(const QImage& frame, const RenderState& state);
+
+private:
+	bool isKept(int index) const;
+	void startPrefetch();
+	void prefetch();
+
+private:
+	QMutex mutex;
+	ImageHandle cacheImage;
+	RenderState cacheState;
+	QHash<int, Frame> cacheFrames;
+	int cacheGeneration = 0; // Changed when prepared frames are dropped, frames rendered for older generation are discarded
+	int playbackIndex = 0;
+	bool isPrefetchRunning = false;
+	bool isStopping = false;
+	QFuture<void> prefetchFuture;
+};
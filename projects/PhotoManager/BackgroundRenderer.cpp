@@ -0,0 +1,151 @@
+#include "BackgroundRenderer.h"
+#include <QtConcurrent>
+#include <QElapsedTimer>
+#include <QPainter>
+#include <QDebug>
+#include "ImageScaler.h"
+
+BackgroundRenderer::BackgroundRenderer(QObject* parent)
+	: QObject(parent)
+{
+	connect(&renderWatcher, &QFutureWatcher<QImage>::finished, this, &BackgroundRenderer::renderFinished);
+	connect(&tileWatcher, &QFutureWatcher<void>::finished, this, [this]() {
+		if (!pendingTiles.isEmpty())
+			startPendingTiles();
+	});
+}
+
+BackgroundRenderer::~BackgroundRenderer()
+{
+	latestTileRequestId.fetchAndAddRelaxed(1);
+	renderWatcher.waitForFinished();
+	tileWatcher.waitForFinished();
+}
+
+void BackgroundRenderer::render(const QImage& image, const QRect& rect, const QSize& size, bool useKernel)
+{
+	pendingRequest = Request();
+	pendingRequest.id = ++latestRequestId;
+	pendingRequest.image = image;
+	pendingRequest.rect = rect;
+	pendingRequest.size = size;
+	pendingRequest.useKernel = useKernel;
+	hasPendingRequest = true;
+
+	if (!renderWatcher.isRunning())
+		startPending();
+}
+
+void BackgroundRenderer::render(const QImage& image, const QTransform& transform, const QSize& size, QImage::Format format)
+{
+	pendingRequest = Request();
+	pendingRequest.id = ++latestRequestId;
+	pendingRequest.image = image;
+	pendingRequest.size = size;
+	pendingRequest.isTransformed = true;
+	pendingRequest.transform = transform;
+	pendingRequest.format = format;
+	hasPendingRequest = true;
+
+	if (!renderWatcher.isRunning())
+		startPending();
+}
+
+void BackgroundRenderer::renderTiles(const QVector<QPoint>& tiles, const TileFunction& renderTile)
+{
+	latestTileRequestId.fetchAndAddRelaxed(1);
+	pendingTiles = tiles;
+	pendingTileFunction = renderTile;
+
+	if (!tileWatcher.isRunning())
+		startPendingTiles();
+}
+
+void BackgroundRenderer::cancel()
+{
+	latestRequestId++;
+	hasPendingRequest = false;
+	pendingRequest = Request();
+
+	latestTileRequestId.fetchAndAddRelaxed(1);
+	pendingTiles.clear();
+	pendingTileFunction = nullptr;
+}
+
+void BackgroundRenderer::startPending()
+{
+	const Request request = pendingRequest;
+	pendingRequest = Request();
+	hasPendingRequest = false;
+	runningRequestId = request.id;
+
+	renderWatcher.setFuture(QtConcurrent::run([request]() {
+		QElapsedTimer timer;
+		timer.start();
+
+		if (request.isTransformed) {
+			QImage result(request.size, request.format);
+			result.fill(Qt::transparent);
+			QPainter painter(&result);
+			painter.setRenderHint(QPainter::SmoothPixmapTransform);
+			painter.setTransform(request.transform);
+			painter.drawImage(0, 0, request.image);
+			painter.end();
+
+			qDebug() << "Rendered in background:" << timer.elapsed() << "ms," << result.size();
+			return result;
+		}
+
+		// Source image is only read, it is shared with the viewer without copying
+		const QImage source = ImageScaler::subImage(request.image, request.rect);
+		QImage result;
+		if (request.useKernel)
+			result = ImageScaler::scaled(source, request.size);
+		else
+			result = source.scaled(request.size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+		if (result.constBits() == source.constBits())
+			result = source.copy();
+
+		// Painter converts grayscale on every repaint, prepared image is small enough to convert once
+		if (result.format() == QImage::Format_Grayscale8)
+			result.convertTo(QImage::Format_RGB32);
+
+		qDebug() << "Rendered in background:" << timer.elapsed() << "ms," << result.size();
+		return result;
+	}));
+}
+
+void BackgroundRenderer::renderFinished()
+{
+	if (runningRequestId == latestRequestId)
+		emit rendered(renderWatcher.result());
+	if (hasPendingRequest)
+		startPending();
+}
+
+void BackgroundRenderer::startPendingTiles()
+{
+	const QVector<QPoint> tiles = pendingTiles;
+	const TileFunction renderTile = pendingTileFunction;
+	const int requestId = latestTileRequestId.loadRelaxed();
+	pendingTiles.clear();
+	pendingTileFunction = nullptr;
+
+	tileWatcher.setFuture(QtConcurrent::run([this, tiles, renderTile, requestId]() {
+		QElapsedTimer timer;
+		timer.start();
+
+		for (const QPoint& tile : tiles) {
+			// Newer request or cancel makes the rest of the batch stale
+			if (latestTileRequestId.loadRelaxed() != requestId)
+				return;
+
+			const QImage image = renderTile(tile);
+			QMetaObject::invokeMethod(this, [this, requestId, tile, image]() {
+				if (latestTileRequestId.loadRelaxed() == requestId)
+					emit tileRendered(tile, image);
+			}, Qt::QueuedConnection);
+		}
+		qDebug() << "Tiles rendered in background:" << tiles.count() << "in" << timer.elapsed() << "ms";
+	}));
+}
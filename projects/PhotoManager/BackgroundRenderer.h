@@ -0,0 +1,76 @@
+#pragma once
+
+#include <QObject>
+#include <QImage>
+#include <QFutureWatcher>
+#include <QAtomicInt>
+#include <QTransform>
+#include <QVector>
+#include <QPoint>
+#include <functional>
+
+// Scales visible area of images (or paints rotated views) smoothly on a thread pool thread. One render runs at a time, requests arriving
+// meanwhile replace each other and only the newest one is started after the running render finishes.
+// Tiles of tiled views are requested in batches, which are queued the same way independently of area renders.
+class BackgroundRenderer : public QObject
+{
+	Q_OBJECT
+
+public:
+	BackgroundRenderer(QObject* parent = nullptr);
+	~BackgroundRenderer();
+
+	// Request smooth scaling of rect in image to size, previous requests become stale.
+	// Own downscaling kernel is used when useKernel is set, otherwise QImage::scaled.
+	void render(const QImage& image, const QRect& rect, const QSize& size, bool useKernel);
+
+	// Request smooth painting of image through transform into image of size and format, used for rotated views.
+	// Replaces previous requests the same way as scaling requests.
+	void render(const QImage& image, const QTransform& transform, const QSize& size, QImage::Format format);
+
+	// Function rendering tile at tile coordinates, called on a thread pool thread
+	typedef std::function<QImage(const QPoint& tile)> TileFunction;
+
+	// Request rendering of tiles, previous tile requests become stale. Tiles of one request are rendered in order
+	// by one thread, tileRendered is emitted for each of them as it finishes.
+	void renderTiles(const QVector<QPoint>& tiles, const TileFunction& renderTile);
+
+	// Make all requests stale, rendered and tileRendered are not emitted for them
+	void cancel();
+
+signals:
+	// Emitted for the newest request only
+	void rendered(const QImage& image);
+
+	// Emitted for tiles of the newest tile request only
+	void tileRendered(const QPoint& tile, const QImage& image);
+
+private:
+	struct Request
+	{
+		int id = 0;
+		QImage image;
+		QRect rect;
+		QSize size;
+		bool useKernel = true;
+		bool isTransformed = false;
+		QTransform transform;
+		QImage::Format format = QImage::Format_RGB32;
+	};
+
+	void startPending();
+	void renderFinished();
+	void startPendingTiles();
+
+private:
+	QFutureWatcher<QImage> renderWatcher;
+	Request pendingRequest;
+	bool hasPendingRequest = false;
+	int latestRequestId = 0;
+	int runningRequestId = 0;
+
+	QFutureWatcher<void> tileWatcher;
+	QVector<QPoint> pendingTiles;
+	TileFunction pendingTileFunction;
+	QAtomicInt latestTileRequestId; // Read by the rendering thread to stop stale requests between tiles
+};
@@ -0,0 +1,19 @@
+#include "CancellableBuffer.h"
+
+CancellableBuffer::CancellableBuffer(const QByteArray& data, const std::function<bool()>& isCancelled)
+	: cancelCheck(isCancelled)
+{
+	setData(data);
+}
+
+bool CancellableBuffer::isCancelled() const
+{
+	return cancelCheck && cancelCheck();
+}
+
+qint64 CancellableBuffer::readData(char* data, qint64 maxSize)
+{
+	if (isCancelled())
+		return -1;
+	return QBuffer::readData(data, maxSize);
+}
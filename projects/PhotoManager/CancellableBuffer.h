@@ -0,0 +1,20 @@
+#pragma once
+
+#include <QBuffer>
+#include <functional>
+
+// Read only buffer which stops delivering data once the cancel check returns true.
+// Decoders reading through it fail at the next strip, tile or scanline block.
+class CancellableBuffer : public QBuffer
+{
+public:
+	CancellableBuffer(const QByteArray& data, const std::function<bool()>& isCancelled);
+
+	bool isCancelled() const;
+
+protected:
+	qint64 readData(char* data, qint64 maxSize) override;
+
+private:
+	std::function<bool()> cancelCheck;
+};
@@ -0,0 +1,105 @@
+#include "DisplayFormat.h"
+#include <qsimd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	// Returns true when alpha bits selected by mask are set in all pixels of line
+	bool isLineOpaque(const quint32* line, int width, quint32 alphaMask)
+	{
+		int x = 0;
+#ifdef __SSE2__
+		const __m128i mask = _mm_set1_epi32(int(alphaMask));
+		__m128i accumulator = mask;
+		for (; x + 16 <= width; x += 16) {
+			const __m128i* pixels = reinterpret_cast<const __m128i*>(line + x);
+			const __m128i a = _mm_and_si128(_mm_loadu_si128(pixels), _mm_loadu_si128(pixels + 1));
+			const __m128i b = _mm_and_si128(_mm_loadu_si128(pixels + 2), _mm_loadu_si128(pixels + 3));
+			accumulator = _mm_and_si128(accumulator, _mm_and_si128(a, b));
+		}
+		for (; x + 4 <= width; x += 4)
+			accumulator = _mm_and_si128(accumulator, _mm_loadu_si128(reinterpret_cast<const __m128i*>(line + x)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(accumulator, mask), mask)) != 0xFFFF)
+			return false;
+#endif
+		quint32 accumulatorTail = alphaMask;
+		for (; x < width; x++)
+			accumulatorTail &= line[x];
+		return (accumulatorTail & alphaMask) == alphaMask;
+	}
+}
+
+QImage DisplayFormat::convert(QImage image)
+{
+	switch (image.format()) {
+		case QImage::Format_Invalid:
+		case QImage::Format_RGB32:
+		case QImage::Format_Grayscale8:
+			return image;
+
+		case QImage::Format_ARGB32:
+		case QImage::Format_ARGB32_Premultiplied:
+			// Alpha of opaque pixels is 0xFF in both formats, pixel data is valid RGB32 without conversion
+			if (isOpaque(image))
+				image.reinterpretAsFormat(QImage::Format_RGB32);
+			else
+				image.convertTo(QImage::Format_ARGB32_Premultiplied);
+			return image;
+
+		case QImage::Format_Grayscale16:
+			image.convertTo(QImage::Format_Grayscale8);
+			return image;
+
+		case QImage::Format_Mono:
+		case QImage::Format_MonoLSB:
+		case QImage::Format_Indexed8:
+			// Color table only is checked, no pixel scan needed
+			if (!image.hasAlphaChannel() && image.allGray()) {
+				image.convertTo(QImage::Format_Grayscale8);
+				return image;
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	if (!image.hasAlphaChannel() || isOpaque(image))
+		image.convertTo(QImage::Format_RGB32);
+	else
+		image.convertTo(QImage::Format_ARGB32_Premultiplied);
+	return image;
+}
+
+bool DisplayFormat::isOpaque(const QImage& image)
+{
+	if (!image.hasAlphaChannel())
+		return true;
+
+	quint32 alphaMask = 0xFF000000;
+	switch (image.format()) {
+		case QImage::Format_ARGB32:
+		case QImage::Format_ARGB32_Premultiplied:
+			break;
+
+		case QImage::Format_RGBA8888:
+		case QImage::Format_RGBA8888_Premultiplied:
+			// Byte order of these formats is fixed in memory, alpha is the last byte
+			alphaMask = (Q_BYTE_ORDER == Q_LITTLE_ENDIAN) ? 0xFF000000 : 0x000000FF;
+			break;
+
+		default:
+			// Remaining formats with alpha are rare (e.g. 16-bit PNG), scan them converted
+			return isOpaque(image.convertToFormat(QImage::Format_ARGB32));
+	}
+
+	const int width = image.width();
+	for (int y = 0; y < image.height(); y++) {
+		if (!isLineOpaque(reinterpret_cast<const quint32*>(image.constScanLine(y)), width, alphaMask))
+			return false;
+	}
+	return true;
+}
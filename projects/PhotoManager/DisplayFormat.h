@@ -0,0 +1,15 @@
+#pragma once
+
+#include <QImage>
+
+// Chooses the cheapest pixel format the viewer can scale and paint directly. Opaque images are stored as RGB32,
+// grayscale images as Grayscale8 and premultiplied ARGB32 is used only for images with real transparency.
+class DisplayFormat
+{
+public:
+	// Converts decoded image to display format, conversion is done in place when image is not shared
+	static QImage convert(QImage image);
+
+	// Returns true when all pixels of image are fully opaque
+	static bool isOpaque(const QImage& image);
+};
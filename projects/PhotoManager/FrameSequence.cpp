@@ -0,0 +1,256 @@
+#include "FrameSequence.h"
+#include <QImageReader>
+#include <QImageIOHandler>
+#include <QFile>
+#include <QMutexLocker>
+#include <QtConcurrent>
+#include <limits>
+#include "ImageFormatRegistry.h"
+#include "DisplayFormat.h"
+
+extern void qt_imageTransform(QImage& src, QImageIOHandler::Transformations orient);
+
+FrameSequence::FrameSequence(const QByteArray& fileData, const QByteArray& format, bool isRegisteredFormat, int frameCount, const QString& mappedFilePath)
+	: sequenceFilePath(mappedFilePath), sequenceFormat(format), sequenceRegisteredFormat(isRegisteredFormat), sequenceFrameCount(frameCount)
+{
+	ring.resize(RingSize);
+	delays.fill(-1, frameCount);
+	if (sequenceFilePath.isEmpty()) {
+		sequenceData = fileData;
+		sequenceBuffer.setData(sequenceData);
+		sequenceBuffer.open(QIODevice::ReadOnly);
+	}
+}
+
+FrameSequence::~FrameSequence()
+{
+	// Decoders read from the buffer, release them first
+	sequenceReader.reset();
+	sequenceHandler.reset();
+}
+
+QImage FrameSequence::frame(int index, int* delay)
+{
+	if (index < 0 || index >= sequenceFrameCount)
+		return QImage();
+
+	DecodedFrame decoded;
+	{
+		// Ring slots are written only while decoder is locked, frame cannot be evicted before it is read
+		QMutexLocker decoderLocker(&decoderMutex);
+		if (!decodeFrame(index))
+			return QImage();
+		QMutexLocker locker(&mutex);
+		decoded = ring.at(index % RingSize);
+	}
+	if (delay != nullptr)
+		*delay = decoded.delay;
+
+	// Decode following frames in the background so that playback does not wait for them
+	startPrefetch(index + 1);
+	return decoded.image;
+}
+
+QImage FrameSequence::availableFrame(int index)
+{
+	if (index < 0 || index >= sequenceFrameCount)
+		return QImage();
+
+	QMutexLocker locker(&mutex);
+	const DecodedFrame& decoded = ring.at(index % RingSize);
+	if (decoded.index != index) {
+		// Missing frame is decoded first, caller asks for it again later
+		locker.unlock();
+		startPrefetch(index);
+		return QImage();
+	}
+	QImage image = decoded.image;
+	locker.unlock();
+
+	startPrefetch(index + 1);
+	return image;
+}
+
+int FrameSequence::frameDelay(int index) const
+{
+	QMutexLocker locker(&mutex);
+	return delays.value(index, -1);
+}
+
+qint64 FrameSequence::maximumCost(qint64 frameSize) const
+{
+	const qint64 dataSize = sequenceFilePath.isEmpty() ? sequenceData.size() : 0;
+	return dataSize + qMin(RingSize, sequenceFrameCount) * frameSize;
+}
+
+bool FrameSequence::mapFile()
+{
+	if (sequenceFilePath.isEmpty() || sequenceMappedFile)
+		return true;
+
+	sequenceMappedFile.reset(new QFile(sequenceFilePath));
+	const qint64 fileSize = sequenceMappedFile->open(QFile::ReadOnly) ? sequenceMappedFile->size() : 0;
+	uchar* mappedData = nullptr;
+	if (fileSize > 0 && fileSize <= std::numeric_limits<int>::max())
+		mappedData = sequenceMappedFile->map(0, fileSize);
+	if (mappedData == nullptr) {
+		sequenceMappedFile.reset();
+		return false;
+	}
+
+	sequenceData = QByteArray::fromRawData(reinterpret_cast<const char*>(mappedData), static_cast<int>(fileSize));
+	sequenceBuffer.setData(sequenceData);
+	sequenceBuffer.open(QIODevice::ReadOnly);
+	return true;
+}
+
+void FrameSequence::unmapFile()
+{
+	if (!sequenceMappedFile)
+		return;
+
+	// Decoders and data reference the mapping, release them first. Decoding starts over after the file is mapped again.
+	sequenceReader.reset();
+	sequenceHandler.reset();
+	sequenceBuffer.close();
+	sequenceBuffer.setData(QByteArray());
+	sequenceData.clear();
+	sequenceMappedFile.reset();
+	nextDecodedIndex = 0;
+}
+
+bool FrameSequence::restart()
+{
+	sequenceReader.reset();
+	sequenceHandler.reset();
+	if (!mapFile())
+		return false;
+	sequenceBuffer.seek(0);
+	nextDecodedIndex = 0;
+
+	if (sequenceRegisteredFormat) {
+		sequenceHandler.reset(ImageFormatRegistry::instance().createHandler(sequenceFormat));
+		if (!sequenceHandler)
+			return false;
+		sequenceHandler->setDevice(&sequenceBuffer);
+		return sequenceHandler->canRead();
+	}
+
+	sequenceReader.reset(new QImageReader(&sequenceBuffer, sequenceFormat));
+	sequenceReader->setAutoTransform(true);
+	return sequenceReader->canRead();
+}
+
+bool FrameSequence::seek(int index)
+{
+	if (!sequenceHandler && !sequenceReader && !restart())
+		return false;
+	if (index == nextDecodedIndex)
+		return true;
+
+	// Random access when decoder supports it (e.g. TIFF directories)
+	if (sequenceHandler && sequenceHandler->jumpToImage(index)) {
+		nextDecodedIndex = index;
+		return true;
+	}
+	if (sequenceReader && sequenceReader->jumpToImage(index)) {
+		nextDecodedIndex = index;
+		return true;
+	}
+
+	// Sequential formats (e.g. GIF) are decoded from the start, frames on the way are kept in the ring
+	if (index < nextDecodedIndex && !restart())
+		return false;
+	while (nextDecodedIndex < index) {
+		if (!decodeNext())
+			return false;
+	}
+	return true;
+}
+
+bool FrameSequence::decodeNext()
+{
+	DecodedFrame decoded;
+	decoded.index = nextDecodedIndex;
+
+	if (sequenceHandler) {
+		decoded.delay = sequenceHandler->nextImageDelay();
+		QImage image;
+		if (!sequenceHandler->read(&image))
+			return false;
+		QImageIOHandler::Transformations t = sequenceHandler->option(QImageIOHandler::ImageTransformation).toInt();
+		qt_imageTransform(image, t);
+		decoded.image = DisplayFormat::convert(std::move(image));
+		sequenceHandler->jumpToNextImage();
+	} else {
+		decoded.delay = sequenceReader->nextImageDelay();
+		decoded.image = DisplayFormat::convert(sequenceReader->read());
+		sequenceReader->jumpToNextImage();
+	}
+
+	if (decoded.image.isNull())
+		return false;
+
+	QMutexLocker locker(&mutex);
+	ring[decoded.index % RingSize] = decoded;
+	delays[decoded.index] = decoded.delay;
+	nextDecodedIndex++;
+	return true;
+}
+
+bool FrameSequence::decodeFrame(int index)
+{
+	{
+		QMutexLocker locker(&mutex);
+		if (ring.at(index % RingSize).index == index)
+			return true;
+	}
+	return seek(index) && decodeNext();
+}
+
+void FrameSequence::startPrefetch(int fromIndex)
+{
+	QMutexLocker locker(&mutex);
+	prefetchIndex = fromIndex % sequenceFrameCount;
+
+	QSharedPointer<FrameSequence> self = sharedFromThis();
+	if (isPrefetchRunning || !self)
+		return;
+	isPrefetchRunning = true;
+	QtConcurrent::run([self]() { self->prefetch(); });
+}
+
+void FrameSequence::prefetch()
+{
+	static const int PrefetchCount = RingSize / 2;
+
+	// Number of decodes is bounded, frames of short looping sequences may evict each other from the ring
+	for (int decodeCount = 0; decodeCount < RingSize; decodeCount++) {
+		// Prefetch follows the latest request, playback or seek moves it while frames are decoded
+		int index = -1;
+		{
+			QMutexLocker locker(&mutex);
+			for (int i = 0; i < qMin(PrefetchCount, sequenceFrameCount) && index < 0; i++) {
+				// Animations loop, prefetch continues from the first frame
+				const int candidate = (prefetchIndex + i) % sequenceFrameCount;
+				if (ring.at(candidate % RingSize).index != candidate)
+					index = candidate;
+			}
+			if (index < 0)
+				break;
+		}
+
+		QMutexLocker decoderLocker(&decoderMutex);
+		if (!decodeFrame(index))
+			break;
+	}
+
+	{
+		QMutexLocker locker(&mutex);
+		isPrefetchRunning = false;
+	}
+
+	// Every decode is followed by prefetch, file is unmapped once it goes idle. Frame decoded meanwhile maps it again.
+	QMutexLocker decoderLocker(&decoderMutex);
+	unmapFile();
+}
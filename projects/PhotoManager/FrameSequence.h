@@ -0,0 +1,80 @@
+#pragma once
+
+#include <QByteArray>
+#include <QImage>
+#include <QVector>
+#include <QBuffer>
+#include <QMutex>
+#include <QScopedPointer>
+#include <QEnableSharedFromThis>
+
+class QFile;
+class QImageIOHandler;
+class QImageReader;
+
+// Decodes frames of animations and multi-page files on demand. Keeps a bounded ring of decoded frames
+// and decodes frames following the requested one in the background. Safe to use from multiple threads.
+class FrameSequence : public QEnableSharedFromThis<FrameSequence>
+{
+public:
+	// Number of decoded frames kept in memory
+	static const int RingSize = 16;
+
+	// Decoder is created from file data either by registered format handler or by QImageReader.
+	// With file path the data is not kept, file is mapped while frames are decoded and unmapped when decoding goes idle,
+	// so that the file is not kept open (and locked on Windows) for the lifetime of the image.
+	FrameSequence(const QByteArray& fileData, const QByteArray& format, bool isRegisteredFormat, int frameCount, const QString& mappedFilePath = QString());
+	~FrameSequence();
+
+	int frameCount() const { return sequenceFrameCount; }
+
+	// Returns frame at index, decodes it when not available yet. Delay to the next frame in ms is stored to delay.
+	// Blocks while other frames are decoded, not to be used from GUI thread.
+	QImage frame(int index, int* delay = nullptr);
+
+	// Returns frame at index when it is decoded already, otherwise null image and the frame is decoded in the background.
+	// Does not decode on the calling thread.
+	QImage availableFrame(int index);
+
+	// Returns delay from frame at index to the next frame in ms, -1 when the frame was not decoded yet
+	int frameDelay(int index) const;
+
+	// Returns maximum memory used by kept file data and decoded frames, frame size is size of the first frame in bytes.
+	// Mapped file data is left to the system page cache and not counted.
+	qint64 maximumCost(qint64 frameSize) const;
+
+private:
+	struct DecodedFrame
+	{
+		int index = -1;
+		QImage image;
+		int delay = -1;
+	};
+
+	bool mapFile();
+	void unmapFile();
+	bool restart();
+	bool seek(int index);
+	bool decodeNext();
+	bool decodeFrame(int index);
+	void startPrefetch(int fromIndex);
+	void prefetch();
+
+private:
+	mutable QMutex mutex; // Ring, delays and prefetch state, held only briefly
+	QMutex decoderMutex; // Decoder state, held while decoding
+	QString sequenceFilePath; // Empty when data is kept in memory
+	QScopedPointer<QFile> sequenceMappedFile; // Open only while frames are decoded, declared before data and decoders
+	QByteArray sequenceData;
+	QByteArray sequenceFormat;
+	bool sequenceRegisteredFormat;
+	int sequenceFrameCount;
+	QBuffer sequenceBuffer;
+	QScopedPointer<QImageIOHandler> sequenceHandler;
+	QScopedPointer<QImageReader> sequenceReader;
+	int nextDecodedIndex = 0;
+	QVector<DecodedFrame> ring;
+	QVector<int> delays; // Kept for all frames decoded so far, small enough not to be evicted
+	int prefetchIndex = 0;
+	bool isPrefetchRunning = false;
+};
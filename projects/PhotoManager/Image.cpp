@@ -2,12 +2,16 @@
 #include <QImageReader>
 #include <QFileInfo>
 #include <QElapsedTimer>
-#include <QBuffer>
 #include <QIcon>
 #include <QDebug>
+#include <limits>
 #include "MetadataReader.h"
-#include "qtiff/qtiffhandler.h"
-#include "libqpsd/qpsdhandler.h"
+#include "CancellableBuffer.h"
+#include "ImageFormatRegistry.h"
+#include "JpegHandler.h"
+#include "FrameSequence.h"
+#include "DisplayFormat.h"
+#include "ImagePyramid.h"
 
 extern void qt_imageTransform(QImage& src, QImageIOHandler::Transformations orient);
 
@@ -17,13 +21,24 @@ Image::Image()
 Image::~Image()
 {}
 
-void Image::load(const QString& fileName)
+bool Image::load(const QString& fileName, const std::function<bool()>& isCancelled, const QByteArray& cachedFileData, const QSize& targetSize)
 {
-	imageCurrentFrameIndex = 0;
 	imageDataSize = 0;
 	imageFrameDataSize = 0;
-
-	loadImageData(fileName);
+	loadCancelCheck = isCancelled;
+	imageLoadTargetSize = targetSize;
+
+	// Embedded preview is shown while large image is being decoded, smaller images decode fast enough
+	// and the preview would only flicker before them. Preview is read together with metadata.
+	static const qint64 PreviewMinPixels = 20LL * 1000 * 1000;
+	EmbeddedPreview embeddedPreview;
+	embeddedPreview.minPixels = PreviewMinPixels;
+	loadImageData(fileName, cachedFileData, previewHandler ? &embeddedPreview : nullptr);
+	if (isLoadCancelled()) {
+		releaseFileData();
+		loadCancelCheck = nullptr;
+		return false;
+	}
 
 	// Format Compatibility Notes
 	// TGA - Must be without RLE compression and origin must be TopLeft
@@ -33,90 +48,119 @@ void Image::load(const QString& fileName)
 	// QStringList QImageReader::textKeys() const
 	// QString QImageReader::text(const QString &key) const
 
+	if (previewHandler && !isLoadCancelled()) {
+		ImageHandle preview = loadPreview(embeddedPreview);
+		if (preview)
+			previewHandler(preview);
+	}
+	previewHandler = nullptr;
+
 	QElapsedTimer timer;
 	timer.start();
 
-	QBuffer buffer(&imageFileData);
+	CancellableBuffer buffer(imageFileData, loadCancelCheck);
 	buffer.open(QIODevice::ReadOnly);
 
-	// Try all available readers
+	// Identify format once from file header, formats without own decoder go through QImageReader
+	imageDecoderFormat = ImageFormatRegistry::instance().identify(imageFileData.left(ImageFormatRegistry::HeaderSize));
+	QScopedPointer<QImageIOHandler> imageHandler(ImageFormatRegistry::instance().createHandler(imageDecoderFormat));
+
 	bool finishedRead = false;
-	if (!finishedRead)
-		finishedRead = readAllFrameDataPsd(&buffer);
-	if (!finishedRead)
-		finishedRead = readAllFrameDataTiff(&buffer);
-	if (!finishedRead)
-		finishedRead = readAllFrameDataReader(&buffer);
+	if (imageHandler && !isLoadCancelled()) {
+		imageHandler->setDevice(&buffer);
+		if (imageHandler->canRead())
+			finishedRead = readFrameDataIoHandler(imageHandler.data());
+	}
+	if (!finishedRead && !isLoadCancelled())
+		finishedRead = readFrameDataReader(&buffer);
 
 	buffer.close();
-	imageFileData.clear();
-	imageDataSize = 0;
+
+	bool wasCancelled = isLoadCancelled();
+	loadCancelCheck = nullptr;
+	if (wasCancelled) {
+		releaseFileData();
+		imageFrames.clear();
+		imageFrameSequence.reset();
+		qDebug() << "Cancelled after:" << timer.elapsed() << "ms," << imageFileName;
+		return false;
+	}
 
 	imageTimeBitmapFrames = timer.restart();
-	qDebug() << "Loaded in:" << imageTimeBitmapFrames << "ms, cost:" << imageFrameDataSize << "MB";
+	qDebug() << "Loaded in:" << imageTimeBitmapFrames << "ms, cost:" << imageFrameDataSize / 1024 << "KB, scale:" << imageResolutionScale;
 
 	if (imageFrames.isEmpty())
-		return;
-
-	currentImage = imageFrames.at(0).image;
+		return true;
 
 	if (imageFileType == "svg" || imageFileType == "svgz") {
 		imageType = Type::Vector;
-	} else if (imageFrames.count() > 1) {
+	} else if (frameCount() > 1) {
 		imageType = Type::Movie;
 	} else {
 		imageType = Type::Bitmap;
+		if (ImagePyramid::isUseful(imageFrames.first().image.size()))
+			imagePyramid.reset(new ImagePyramid());
 	}
+	return true;
 }
 
-int Image::cacheSize() const
+void Image::releaseFileData()
 {
-	return qMax(1, imageDataSize + imageFrameDataSize);
+	// Data must not reference the mapping when the file is unmapped
+	imageFileData.clear();
+	imageMappedFile.reset();
+	imageIsFileDataMapped = false;
+	imageDataSize = 0;
 }
 
-void Image::rotate(double angle)
+qint64 Image::cacheSize() const
 {
-	QTransform transform;
-	transform.rotate(angle);
-
-	if (angle == 0 || angle == 90 || angle == 180 || angle == 270)
-		currentImage = currentImage.transformed(transform, Qt::FastTransformation);
-	else
-		currentImage = currentImage.transformed(transform, Qt::SmoothTransformation);
+	qint64 size = sizeof(Image) + imageDataSize + imageFrameDataSize;
+	if (imageFrameSequence)
+		size += imageFrameSequence->maximumCost(imageFrameDataSize);
+	if (imagePyramid)
+		size += ImagePyramid::maximumCost(imageFrameDataSize);
+	return size;
 }
 
-int Image::currentFrameDelay()
+int Image::frameCount() const
 {
-	if (imageFrames.isEmpty())
-		return 0;
-	return imageFrames.at(imageCurrentFrameIndex).delay;
+	if (imageFrameSequence)
+		return imageFrameSequence->frameCount();
+	return imageFrames.count();
 }
 
-void Image::jumpToNextImage()
+QImage Image::frame(int index) const
 {
-	if (imageFrames.isEmpty())
-		return;
-
-	imageCurrentFrameIndex++;
-	if (imageCurrentFrameIndex >= imageFrames.count())
-		imageCurrentFrameIndex = 0;
-
-	currentImage = imageFrames.at(imageCurrentFrameIndex).image;
+	if (index >= 0 && index < imageFrames.count())
+		return imageFrames.at(index).image;
+	if (imageFrameSequence)
+		return imageFrameSequence->frame(index);
+	return QImage();
 }
 
-void Image::jumpToPreviousImage()
+QImage Image::availableFrame(int index) const
 {
-	if (imageFrames.isEmpty())
-		return;
-
-	imageCurrentFrameIndex--;
-	if (imageCurrentFrameIndex < 0)
-		imageCurrentFrameIndex = imageFrames.count() - 1;
+	if (index >= 0 && index < imageFrames.count())
+		return imageFrames.at(index).image;
+	if (imageFrameSequence)
+		return imageFrameSequence->availableFrame(index);
+	return QImage();
+}
 
-	currentImage = imageFrames.at(imageCurrentFrameIndex).image;
+int Image::frameDelay(int index) const
+{
+	if (index >= 0 && index < imageFrames.count())
+		return imageFrames.at(index).delay;
+
+	// Delays are read by decoder together with frames, not decoded frames play at the pace of the first one
+	const int delay = imageFrameSequence ? imageFrameSequence->frameDelay(index) : -1;
+	if (delay < 0 && !imageFrames.isEmpty())
+		return imageFrames.first().delay;
+	return delay;
 }
 
-bool Image::loadImageData(const QString& fileName)
+bool Image::loadImageData(const QString& fileName, const QByteArray& cachedFileData, EmbeddedPreview* preview)
 {
 	QElapsedTimer timer;
 	timer.start();
@@ -126,98 +170,172 @@ bool Image::loadImageData(const QString& fileName)
 	imageFileName = fileInfo.fileName();
 	imageFileType = fileInfo.suffix().toLower();
 
-	QFile imageFile(imageFilePath);
-	if (!imageFile.open(QFile::ReadOnly))
-		return false;
-
-	imageFileData = imageFile.readAll();
-	imageDataSize = static_cast<int>((double)imageFileData.size() / (1024 * 1024) + 0.5);
+	if (!cachedFileData.isEmpty()) {
+		// File data kept in cache, no disk access needed
+		imageFileData = cachedFileData;
+	} else {
+		imageMappedFile.reset(new QFile(imageFilePath));
+		if (!imageMappedFile->open(QFile::ReadOnly)) {
+			imageMappedFile.reset();
+			return false;
+		}
+
+		// Map file read only, decoders read directly from the page cache without copying the file to the heap
+		const qint64 fileSize = imageMappedFile->size();
+		uchar* mappedData = nullptr;
+		if (fileSize > 0 && fileSize <= std::numeric_limits<int>::max())
+			mappedData = imageMappedFile->map(0, fileSize);
+
+		if (mappedData != nullptr) {
+			imageFileData = QByteArray::fromRawData(reinterpret_cast<const char*>(mappedData), static_cast<int>(fileSize));
+			imageIsFileDataMapped = true;
+		} else {
+			// Filesystem does not support mapping
+			imageFileData = imageMappedFile->readAll();
+			imageMappedFile.reset();
+		}
+	}
+	imageDataSize = imageFileData.size();
 
 	imageTimeFileLoad = timer.restart();
 
 	MetadataReader metadataReader;
-	imageMetadata = metadataReader.load(imageFileData, imageFileType);
+	imageMetadata = metadataReader.load(imageFileData, imageFileType, preview);
 
 	imageTimeMetadata = timer.restart();
-	qDebug() << "Preloaded in:" << imageTimeFileLoad + imageTimeMetadata << "ms, cost:" << cacheSize() << "MB, metadata:" << imageTimeMetadata << "ms";
+	qDebug() << "Preloaded in:" << imageTimeFileLoad + imageTimeMetadata << "ms, cost:" << cacheSize() / 1024 << "KB, metadata:" << imageTimeMetadata << "ms";
 
 	return true;
 }
 
-bool Image::readAllFrameDataReader(QIODevice* device)
+ImageHandle Image::loadPreview(const EmbeddedPreview& embeddedPreview) const
 {
-	QImageReader imageReader(imageFilePath);
+	if (embeddedPreview.data.isEmpty())
+		return ImageHandle();
+
+	QElapsedTimer timer;
+	timer.start();
+
+	QImage previewImage = QImage::fromData(embeddedPreview.data);
+	if (previewImage.isNull())
+		return ImageHandle();
+
+	QSize fullSize = embeddedPreview.imageSize;
+	QImageIOHandler::Transformations transformation = JpegHandler::exifOrientationTransformation(embeddedPreview.orientation);
+	qt_imageTransform(previewImage, transformation);
+	if (transformation.testFlag(QImageIOHandler::TransformationRotate90))
+		fullSize.transpose();
+	if (previewImage.width() >= fullSize.width())
+		return ImageHandle();
+
+	QSharedPointer<Image> preview(new Image());
+	preview->imageFilePath = imageFilePath;
+	preview->imageFileName = imageFileName;
+	preview->imageFileType = imageFileType;
+	preview->imageMetadata = imageMetadata;
+	preview->imageFrames.append(ImageFrame(DisplayFormat::convert(previewImage), -1));
+	preview->imageFrameDataSize = preview->imageFrames.first().image.sizeInBytes();
+	preview->imageFullSize = fullSize;
+	preview->imageResolutionScale = double(previewImage.width()) / fullSize.width();
+	preview->imageIsPreview = true;
+	preview->imageTimeFileLoad = imageTimeFileLoad;
+	preview->imageTimeMetadata = imageTimeMetadata;
+
+	qDebug() << "Preview loaded in:" << timer.elapsed() << "ms," << previewImage.size();
+	return preview;
+}
+
+bool Image::readFrameDataReader(QIODevice* device)
+{
+	// Decode from already loaded file data, format is detected from content
+	device->seek(0);
+	QImageReader imageReader(device);
+	imageReader.setDecideFormatFromContent(true);
 	imageReader.setAutoTransform(true);
 
-	if (!imageReader.canRead())
-		return false;
+	if (!imageReader.canRead()) {
+		// Formats without signature (e.g. TGA) are recognized only by file extension
+		device->seek(0);
+		imageReader.setFormat(imageFileType.toLatin1());
+		imageReader.setDecideFormatFromContent(false);
+		imageReader.setDevice(device);
+		if (!imageReader.canRead())
+			return false;
+	}
 
-	// Read all frames
+	// Read first frame, other frames are decoded on demand
 	imageFrameDataSize = 0;
 	const int imageCount = imageReader.imageCount();
-	for (int i = 0; i < imageCount; i++) {
+	if (imageCount > 0 && !isLoadCancelled()) {
 		ImageFrame frame;
 		frame.delay = imageReader.nextImageDelay();
-		frame.image = imageReader.read().convertToFormat(QImage::Format_ARGB32_Premultiplied);
-		if (frame.image.isNull())
-			break;
-
-		int size = static_cast<int>((double)frame.image.sizeInBytes() / (1024 * 1024) + 0.5);
-		imageFrameDataSize += size;
-		imageFrames.append(frame);
-
-		imageReader.jumpToNextImage();
+		frame.image = DisplayFormat::convert(imageReader.read());
+		if (!frame.image.isNull()) {
+			imageFrameDataSize += frame.image.sizeInBytes();
+			imageFrames.append(frame);
+			if (imageCount > 1)
+				createFrameSequence(imageReader.format(), false, imageCount);
+		}
 	}
 
 	return true;
 }
 
-bool Image::readAllFrameDataIoHandler(QImageIOHandler* imageHandler)
+bool Image::readFrameDataIoHandler(QImageIOHandler* imageHandler)
 {
-	// Read all frames
-	imageFrameDataSize = 0;
+	// Single frame images are decoded at reduced resolution when full size is not needed for display
 	const int imageCount = imageHandler->imageCount();
-	for (int i = 0; i < imageCount; i++) {
+	const bool isScaledRead = (imageLoadTargetSize.isValid() && imageCount == 1 && imageHandler->supportsOption(QImageIOHandler::ScaledSize));
+	if (isScaledRead)
+		imageHandler->setOption(QImageIOHandler::ScaledSize, imageLoadTargetSize);
+
+	// Read first frame, other frames are decoded on demand
+	imageFrameDataSize = 0;
+	if (imageCount > 0 && !isLoadCancelled()) {
 		ImageFrame frame;
 		frame.delay = imageHandler->nextImageDelay();
 
 		QImage img;
 		imageHandler->read(&img);
-		frame.image = img.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+		frame.image = DisplayFormat::convert(std::move(img));
 		if (frame.image.isNull())
-			break;
+			return false;
 
 		QImageIOHandler::Transformations t = imageHandler->option(QImageIOHandler::ImageTransformation).toInt();
 		qt_imageTransform(frame.image, t);
 
-		int size = static_cast<int>((double)frame.image.sizeInBytes() / (1024 * 1024) + 0.5);
-		imageFrameDataSize += size;
+		if (isScaledRead) {
+			QSize fullSize = imageHandler->option(QImageIOHandler::Size).toSize();
+			if (t.testFlag(QImageIOHandler::TransformationRotate90))
+				fullSize.transpose();
+			if (fullSize.width() > frame.image.width()) {
+				imageFullSize = fullSize;
+				imageResolutionScale = double(frame.image.width()) / fullSize.width();
+			}
+		}
+
+		imageFrameDataSize += frame.image.sizeInBytes();
 		imageFrames.append(frame);
-
-		imageHandler->jumpToNextImage();
+		if (imageCount > 1)
+			createFrameSequence(imageDecoderFormat, true, imageCount);
 	}
 
-	return true;
-}
-
-bool Image::readAllFrameDataTiff(QIODevice* device)
-{
-	QScopedPointer<QImageIOHandler> tiffHandler(new QTiffHandler());
-	tiffHandler->setDevice(device);
-
-	if (!tiffHandler->canRead())
-		return false;
-
-	return readAllFrameDataIoHandler(tiffHandler.data());
+	// Let other readers try data the decoder failed on (e.g. CMYK JPEG)
+	return !imageFrames.isEmpty();
 }
 
-bool Image::readAllFrameDataPsd(QIODevice* device)
+void Image::createFrameSequence(const QByteArray& format, bool isRegisteredFormat, int frameCount)
 {
-	QScopedPointer<QImageIOHandler> psdHandler(new QPsdHandler());
-	psdHandler->setDevice(device);
-
-	if (!psdHandler->canRead())
-		return false;
-
-	return readAllFrameDataIoHandler(psdHandler.data());
+	// Frame sequence outlives file data released after load and the file must not stay open with it.
+	// Small mapped files are copied, loading still reads the mapping, copy is shared with the file data tier.
+	// Large files are mapped again by the sequence while it decodes.
+	if (!imageIsFileDataMapped) {
+		imageFrameSequence = QSharedPointer<FrameSequence>::create(imageFileData, format, isRegisteredFormat, frameCount);
+	} else if (imageFileData.size() < LargeFileSize) {
+		imageFileData = QByteArray(imageFileData.constData(), imageFileData.size());
+		imageIsFileDataMapped = false;
+		imageFrameSequence = QSharedPointer<FrameSequence>::create(imageFileData, format, isRegisteredFormat, frameCount);
+	} else {
+		imageFrameSequence = QSharedPointer<FrameSequence>::create(QByteArray(), format, isRegisteredFormat, frameCount, imageFilePath);
+	}
 }
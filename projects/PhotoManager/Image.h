@@ -2,9 +2,21 @@
 
 #include <QImage>
 #include <QVector>
+#include <QSharedPointer>
+#include <QScopedPointer>
+#include <QFile>
 #include <qimageiohandler.h>
+#include <functional>
 #include "MetadataCollection.h"
 
+class Image;
+class FrameSequence;
+class ImagePyramid;
+struct EmbeddedPreview;
+
+// Decoded images are immutable once loaded and shared between cache, worker threads and viewer without copying
+typedef QSharedPointer<const Image> ImageHandle;
+
 class Image
 {
 public:
@@ -22,71 +34,102 @@ public:
 		ImageFrame(const QImage& img, int delay) : image(img), delay(delay) {}
 	};
 
+	// Mapped files from this size are not copied to the heap after load
+	static const int LargeFileSize = 64 * 1024 * 1024;
+
 	Image();
 	~Image();
 
-	// Load image data from disk and read metadata
-	void load(const QString& fileName);
+	// Load image data from disk (or from cached file data when available) and read metadata.
+	// Decoders supporting it may decode at reduced resolution still covering the target size, invalid target size loads full resolution.
+	// Returns false when loading was interrupted by the cancel check.
+	bool load(const QString& fileName, const std::function<bool()>& isCancelled = nullptr, const QByteArray& cachedFileData = QByteArray(), const QSize& targetSize = QSize());
 
-	// Returns size of loaded image data in MB
-	int cacheSize() const;
+	// Set function receiving embedded preview of large images during load, called before the main image is decoded
+	void setPreviewHandler(const std::function<void(const ImageHandle&)>& handler) { previewHandler = handler; }
 
-	// Returns raw image file data
+	// Returns size of loaded image data in bytes
+	qint64 cacheSize() const;
+
+	// Returns raw image file data, kept after load until released
 	const QByteArray& data() const { return imageFileData; }
+	void releaseFileData();
+
+	// Returns true when file data points into memory mapped file, data is valid only until released
+	bool isFileDataMapped() const { return imageIsFileDataMapped; }
 
 	Type type() const { return imageType; }
 	const QString& absoluteFilePath() const { return imageFilePath; }
 	const QString& fileName() const { return imageFileName; }
 	const MetadataCollection& metadata() const { return imageMetadata; }
 
-	// Rotate current image
-	void rotate(double angle);
+	// Return first frame
+	QImage image() const { return frame(0); }
+
+	// Returns size of image at full resolution, frames may be smaller when decoded at reduced resolution
+	QSize size() const { return imageFullSize.isValid() ? imageFullSize : image().size(); }
+
+	// Returns ratio between size of decoded frames and full image size
+	double resolutionScale() const { return imageResolutionScale; }
+	bool isFullResolution() const { return imageResolutionScale >= 1.0; }
+
+	// Returns true for provisional image created from embedded preview
+	bool isPreview() const { return imageIsPreview; }
+
+	// Return number of frames, frames after the first one are decoded on demand
+	int frameCount() const;
 
-	// Return current frame
-	const QImage& image() const { return currentImage; }
-	QSize size() const { return currentImage.size(); }
+	// Return frame at index, null image when index is out of range or frame cannot be decoded.
+	// Frames after the first one may be decoded on the calling thread.
+	QImage frame(int index) const;
 
-	// Return number of loaded frames
-	int frameCount() const { return imageFrames.count(); }
+	// Return frame at index when it is decoded already, otherwise null image and the frame is decoded in the background
+	QImage availableFrame(int index) const;
 
-	// Returns animation delay in ms to the next frame
-	int currentFrameDelay();
+	// Returns animation delay in ms from frame at index to the next frame, delay of the first frame until the frame is decoded
+	int frameDelay(int index) const;
 
-	// Return current image frame
-	int currentFrameIndex() const { return imageCurrentFrameIndex; }
+	// Returns half resolution levels of large bitmaps, built on request. Null for other images.
+	ImagePyramid* pyramid() const { return imagePyramid.data(); }
 
-	// Set current image to next image in sequence
-	void jumpToNextImage();
-	void jumpToPreviousImage();
-	
 	// Returns info about image load timing
 	qint64 elapsedTimeFileLoad() const { return imageTimeFileLoad; }
 	qint64 elapsedTimeMetadata() const { return imageTimeMetadata; }
 	qint64 elapsedTimeBitmapFrames() const { return imageTimeBitmapFrames; }
 
 private:
-	bool loadImageData(const QString& fileName);
-	bool readAllFrameDataReader(QIODevice* device);
-	bool readAllFrameDataIoHandler(QImageIOHandler* imageHandler);
-	bool readAllFrameDataTiff(QIODevice* device);
-	bool readAllFrameDataPsd(QIODevice* device);
+	bool loadImageData(const QString& fileName, const QByteArray& cachedFileData, EmbeddedPreview* preview);
+	bool readFrameDataReader(QIODevice* device);
+	bool readFrameDataIoHandler(QImageIOHandler* imageHandler);
+	void createFrameSequence(const QByteArray& format, bool isRegisteredFormat, int frameCount);
+	bool isLoadCancelled() const { return loadCancelCheck && loadCancelCheck(); }
+	ImageHandle loadPreview(const EmbeddedPreview& embeddedPreview) const;
 
 private:
 	QString imageFilePath;
 	QString imageFileName;
 	QString imageFileType;
-	int imageDataSize = 0;
-	int imageFrameDataSize = 0;
+	qint64 imageDataSize = 0;
+	qint64 imageFrameDataSize = 0;
 	QByteArray imageFileData;
-	QVector<ImageFrame> imageFrames;
-	QImage currentImage;
-	int imageCurrentFrameIndex = 0;
+	QScopedPointer<QFile> imageMappedFile; // Unmapped when file data is released
+	bool imageIsFileDataMapped = false;
+	QVector<ImageFrame> imageFrames; // First frame, other frames of animations and multi-page files are in frame sequence
+	QSharedPointer<FrameSequence> imageFrameSequence;
+	QScopedPointer<ImagePyramid> imagePyramid;
+	QByteArray imageDecoderFormat;
+	QSize imageFullSize;
+	QSize imageLoadTargetSize;
+	double imageResolutionScale = 1.0;
+	bool imageIsPreview = false;
 	MetadataCollection imageMetadata;
 	Type imageType = Type::Bitmap;
+	std::function<bool()> loadCancelCheck;
+	std::function<void(const ImageHandle&)> previewHandler;
 
 	qint64 imageTimeBitmapFrames = 0;
 	qint64 imageTimeMetadata = 0;
 	qint64 imageTimeFileLoad = 0;
 };
 
-Q_DECLARE_METATYPE(Image);
+Q_DECLARE_METATYPE(ImageHandle);
@@ -0,0 +1,271 @@
+#include "ImageCache.h"
+#include <QMutex>
+#include <QFile>
+#include <QDebug>
+
+#ifdef Q_OS_WIN
+#include <qt_windows.h>
+#endif
+
+// Keep at least this much physical memory free for the system and other applications
+static const qint64 MemoryReserveMin = 512LL * 1024 * 1024;
+static const int MemoryReservePercent = 10;
+
+// Minimal interval between two checks of system memory
+static const qint64 MemoryCheckInterval = 500;
+
+ImageCache::ImageCache(qint64 maxCost, qint64 fileDataMaxCost)
+{
+	mutex = new QMutex();
+	decodedTier.maxCost = maxCost;
+	fileDataTier.maxCost = fileDataMaxCost;
+}
+
+ImageCache::~ImageCache()
+{
+	delete mutex;
+}
+
+void ImageCache::setMaxCost(qint64 bytes)
+{
+	QMutexLocker locker(mutex);
+	decodedTier.maxCost = qMax<qint64>(0, bytes);
+	trim(decodedTier, decodedTier.effectiveMaxCost());
+}
+
+qint64 ImageCache::maxCost() const
+{
+	QMutexLocker locker(mutex);
+	return decodedTier.effectiveMaxCost();
+}
+
+void ImageCache::setFileDataMaxCost(qint64 bytes)
+{
+	QMutexLocker locker(mutex);
+	fileDataTier.maxCost = qMax<qint64>(0, bytes);
+	trim(fileDataTier, fileDataTier.effectiveMaxCost());
+}
+
+qint64 ImageCache::fileDataMaxCost() const
+{
+	QMutexLocker locker(mutex);
+	return fileDataTier.effectiveMaxCost();
+}
+
+qint64 ImageCache::totalCost() const
+{
+	QMutexLocker locker(mutex);
+	return decodedTier.totalCost;
+}
+
+int ImageCache::count() const
+{
+	QMutexLocker locker(mutex);
+	return decodedTier.entries.count();
+}
+
+bool ImageCache::contains(const QString& key) const
+{
+	QMutexLocker locker(mutex);
+	return decodedTier.entries.contains(key);
+}
+
+ImageHandle ImageCache::object(const QString& key)
+{
+	QMutexLocker locker(mutex);
+	auto it = decodedTier.entries.find(key);
+	if (it == decodedTier.entries.end())
+		return ImageHandle();
+
+	it->lastUse = ++cacheUseCounter;
+	return it->image;
+}
+
+void ImageCache::insert(const QString& key, const ImageHandle& image, qint64 cost)
+{
+	checkMemoryPressure();
+
+	Entry entry;
+	entry.image = image;
+	entry.cost = cost;
+
+	QMutexLocker locker(mutex);
+	insertEntry(decodedTier, key, entry);
+}
+
+bool ImageCache::fileData(const QString& key, QByteArray* data)
+{
+	QMutexLocker locker(mutex);
+	auto it = fileDataTier.entries.find(key);
+	if (it == fileDataTier.entries.end())
+		return false;
+
+	it->lastUse = ++cacheUseCounter;
+	*data = it->data;
+	return true;
+}
+
+void ImageCache::insertFileData(const QString& key, const QByteArray& data)
+{
+	if (data.isEmpty())
+		return;
+
+	checkMemoryPressure();
+
+	Entry entry;
+	entry.data = data;
+	entry.cost = data.size();
+
+	QMutexLocker locker(mutex);
+	insertEntry(fileDataTier, key, entry);
+}
+
+void ImageCache::remove(const QString& key)
+{
+	QMutexLocker locker(mutex);
+	removeEntry(decodedTier, key);
+	removeEntry(fileDataTier, key);
+}
+
+void ImageCache::clear()
+{
+	QMutexLocker locker(mutex);
+	decodedTier.entries.clear();
+	decodedTier.totalCost = 0;
+	fileDataTier.entries.clear();
+	fileDataTier.totalCost = 0;
+}
+
+void ImageCache::checkMemoryPressure()
+{
+	QMutexLocker locker(mutex);
+	if (pressureCheckTimer.isValid() && pressureCheckTimer.elapsed() < MemoryCheckInterval)
+		return;
+	pressureCheckTimer.start();
+
+	qint64 totalMemory = 0;
+	qint64 availableMemory = availableSystemMemory(&totalMemory);
+	if (availableMemory < 0)
+		return;
+
+	const qint64 reserve = qMax(MemoryReserveMin, totalMemory * MemoryReservePercent / 100);
+	if (availableMemory < reserve) {
+		// Give back what is missing to the reserve. Decoded images go first, they are larger and can be rebuilt from file data.
+		qint64 missing = reserve - availableMemory;
+		missing = limitTier(decodedTier, missing);
+		limitTier(fileDataTier, missing);
+		qDebug() << "Memory pressure, available:" << availableMemory / (1024 * 1024) << "MB, cache limited to:"
+			<< decodedTier.effectiveMaxCost() / (1024 * 1024) << "MB +" << fileDataTier.effectiveMaxCost() / (1024 * 1024) << "MB";
+	} else if (availableMemory > 2 * reserve) {
+		// Pressure is gone, let the cache grow up to configured budget again
+		decodedTier.pressureLimit = -1;
+		fileDataTier.pressureLimit = -1;
+	}
+}
+
+qint64 ImageCache::availableSystemMemory(qint64* totalMemory)
+{
+#ifdef Q_OS_WIN
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	if (!GlobalMemoryStatusEx(&status))
+		return -1;
+	if (totalMemory != nullptr)
+		*totalMemory = status.ullTotalPhys;
+	return status.ullAvailPhys;
+#else
+	qint64 total = -1;
+	qint64 available = -1;
+
+	QFile memInfo("/proc/meminfo");
+	if (memInfo.open(QFile::ReadOnly | QFile::Text)) {
+		// Lines look like "MemAvailable:    1234567 kB"
+		const QList<QByteArray> lines = memInfo.readAll().split('\n');
+		for (const QByteArray& line : lines) {
+			const QList<QByteArray> parts = line.simplified().split(' ');
+			if (parts.count() < 2)
+				continue;
+			if (parts.at(0) == "MemTotal:")
+				total = parts.at(1).toLongLong() * 1024;
+			else if (parts.at(0) == "MemAvailable:")
+				available = parts.at(1).toLongLong() * 1024;
+		}
+	}
+
+	// Container limits (cgroup v2, then v1)
+	auto readValue = [](const QString& fileName) -> qint64 {
+		QFile file(fileName);
+		if (!file.open(QFile::ReadOnly | QFile::Text))
+			return -1;
+		bool ok = false;
+		qint64 value = file.readAll().trimmed().toLongLong(&ok);
+		return ok ? value : -1;
+	};
+	qint64 limit = readValue("/sys/fs/cgroup/memory.max");
+	qint64 usage = readValue("/sys/fs/cgroup/memory.current");
+	if (limit < 0) {
+		limit = readValue("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+		usage = readValue("/sys/fs/cgroup/memory/memory.usage_in_bytes");
+	}
+	// Unlimited cgroup v1 reports huge number instead of "max"
+	if (limit > 0 && usage >= 0 && (total < 0 || limit < total)) {
+		total = limit;
+		qint64 cgroupAvailable = qMax<qint64>(0, limit - usage);
+		available = (available < 0) ? cgroupAvailable : qMin(available, cgroupAvailable);
+	}
+
+	if (totalMemory != nullptr)
+		*totalMemory = total;
+	return available;
+#endif
+}
+
+void ImageCache::insertEntry(Tier& tier, const QString& key, const Entry& entry)
+{
+	removeEntry(tier, key);
+
+	// Entry which alone exceeds the budget is not cached at all
+	const qint64 limit = tier.effectiveMaxCost();
+	if (entry.cost > limit)
+		return;
+
+	trim(tier, limit - entry.cost);
+
+	auto it = tier.entries.insert(key, entry);
+	it->lastUse = ++cacheUseCounter;
+	tier.totalCost += entry.cost;
+}
+
+void ImageCache::removeEntry(Tier& tier, const QString& key)
+{
+	auto it = tier.entries.find(key);
+	if (it == tier.entries.end())
+		return;
+
+	tier.totalCost -= it->cost;
+	tier.entries.erase(it);
+}
+
+void ImageCache::trim(Tier& tier, qint64 limit)
+{
+	while (tier.totalCost > limit && !tier.entries.isEmpty()) {
+		// Find least recently used entry, linear search is fine for hundreds of entries
+		auto oldest = tier.entries.begin();
+		for (auto it = tier.entries.begin(); it != tier.entries.end(); ++it) {
+			if (it->lastUse < oldest->lastUse)
+				oldest = it;
+		}
+		tier.totalCost -= oldest->cost;
+		tier.entries.erase(oldest);
+	}
+}
+
+qint64 ImageCache::limitTier(Tier& tier, qint64 bytesToRelease)
+{
+	const qint64 released = qMin(bytesToRelease, tier.totalCost);
+	const qint64 limit = tier.totalCost - released;
+	if (tier.pressureLimit < 0 || limit < tier.pressureLimit)
+		tier.pressureLimit = limit;
+	trim(tier, tier.pressureLimit);
+	return bytesToRelease - released;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QString>
+#include <QHash>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include "Image.h"
+
+class QMutex;
+
+// Thread safe least recently used cache with cost in bytes. Holds two tiers:
+// decoded images ready for display and much smaller raw file data, which can be decoded again without disk access.
+// Shrinks automatically when the system runs low on physical memory.
+class ImageCache
+{
+public:
+	ImageCache(qint64 maxCost = 1024LL * 1024 * 1024, qint64 fileDataMaxCost = 2048LL * 1024 * 1024);
+	~ImageCache();
+
+	// Set memory budget of decoded images in bytes
+	void setMaxCost(qint64 bytes);
+	qint64 maxCost() const;
+
+	// Set memory budget of raw file data in bytes
+	void setFileDataMaxCost(qint64 bytes);
+	qint64 fileDataMaxCost() const;
+
+	// Returns sum of costs of all decoded images in bytes
+	qint64 totalCost() const;
+	int count() const;
+
+	bool contains(const QString& key) const;
+
+	// Returns cached image, null handle when key is not cached.
+	ImageHandle object(const QString& key);
+
+	// Insert decoded image, least recently used images are removed to stay within budget.
+	void insert(const QString& key, const ImageHandle& image, qint64 cost);
+
+	// Copy cached raw file data into data. Returns false when key is not cached.
+	bool fileData(const QString& key, QByteArray* data);
+
+	// Insert raw file data
+	void insertFileData(const QString& key, const QByteArray& data);
+
+	void remove(const QString& key);
+	void clear();
+
+	// Check available system memory and drop cached data when it runs low
+	void checkMemoryPressure();
+
+	// Returns available physical memory (respecting cgroup limits) in bytes, -1 when unknown
+	static qint64 availableSystemMemory(qint64* totalMemory = nullptr);
+
+private:
+	struct Entry
+	{
+		ImageHandle image;
+		QByteArray data;
+		qint64 cost = 0;
+		quint64 lastUse = 0;
+	};
+
+	struct Tier
+	{
+		QHash<QString, Entry> entries;
+		qint64 maxCost = 0;
+		qint64 totalCost = 0;
+		qint64 pressureLimit = -1;
+
+		qint64 effectiveMaxCost() const { return (pressureLimit >= 0) ? qMin(maxCost, pressureLimit) : maxCost; }
+	};
+
+	void insertEntry(Tier& tier, const QString& key, const Entry& entry);
+	void removeEntry(Tier& tier, const QString& key);
+	void trim(Tier& tier, qint64 limit);
+
+	// Lower pressure limit of tier to release requested number of bytes. Returns bytes which could not be released.
+	qint64 limitTier(Tier& tier, qint64 bytesToRelease);
+
+private:
+	QMutex* mutex;
+	Tier decodedTier;
+	Tier fileDataTier;
+	quint64 cacheUseCounter = 0;
+	QElapsedTimer pressureCheckTimer;
+};
@@ -0,0 +1,123 @@
+#include "ImageFormatRegistry.h"
+#include "JpegHandler.h"
+#include "qtiff/qtiffhandler.h"
+#include "libqpsd/qpsdhandler.h"
+#include <QFile>
+#include <QBuffer>
+#include <QImageReader>
+#include <QScopedPointer>
+#include <QElapsedTimer>
+#include <cstring>
+
+ImageFormatRegistry::ImageFormatRegistry()
+{
+	// JPEG, SOI marker followed by any other marker
+	registerFormat("jpeg", QByteArray("\xFF\xD8\xFF", 3), []() { return new JpegHandler(); });
+
+	// Photoshop PSD and PSB (large document) share signature, version follows
+	registerFormat("psd", QByteArray("8BPS\x00\x01", 6), []() { return new QPsdHandler(); });
+	registerFormat("psd", QByteArray("8BPS\x00\x02", 6), []() { return new QPsdHandler(); });
+
+	// TIFF and BigTIFF, little and big endian
+	registerFormat("tiff", QByteArray("II\x2a\x00", 4), []() { return new QTiffHandler(); });
+	registerFormat("tiff", QByteArray("MM\x00\x2a", 4), []() { return new QTiffHandler(); });
+	registerFormat("tiff", QByteArray("II\x2b\x00", 4), []() { return new QTiffHandler(); });
+	registerFormat("tiff", QByteArray("MM\x00\x2b", 4), []() { return new QTiffHandler(); });
+}
+
+ImageFormatRegistry& ImageFormatRegistry::instance()
+{
+	static ImageFormatRegistry registry;
+	return registry;
+}
+
+void ImageFormatRegistry::registerFormat(const QByteArray& format, const QByteArray& signature, const HandlerFactory& factory, int offset)
+{
+	Q_ASSERT(offset + signature.size() <= HeaderSize);
+
+	Format item;
+	item.format = format;
+	item.signature = signature;
+	item.offset = offset;
+	item.factory = factory;
+	registryFormats.append(item);
+}
+
+QByteArray ImageFormatRegistry::identify(const QByteArray& header) const
+{
+	for (const Format& item : registryFormats) {
+		if (header.size() < item.offset + item.signature.size())
+			continue;
+		if (memcmp(header.constData() + item.offset, item.signature.constData(), item.signature.size()) == 0)
+			return item.format;
+	}
+	return QByteArray();
+}
+
+QImageIOHandler* ImageFormatRegistry::createHandler(const QByteArray& format) const
+{
+	for (const Format& item : registryFormats) {
+		if (item.format == format)
+			return item.factory();
+	}
+	return nullptr;
+}
+
+void ImageFormatRegistry::benchmark(const QStringList& fileNames, QTextStream& out)
+{
+	static const int Iterations = 200;
+
+	for (const QString& fileName : fileNames) {
+		QFile file(fileName);
+		if (!file.open(QFile::ReadOnly)) {
+			out << "Benchmark cannot read: " << fileName << Qt::endl;
+			continue;
+		}
+		const QByteArray data = file.readAll();
+		QBuffer buffer;
+		buffer.setData(data);
+		buffer.open(QIODevice::ReadOnly);
+
+		// Probe chain used before signature dispatch, each decoder checks the data in turn
+		QElapsedTimer timer;
+		timer.start();
+		for (int i = 0; i < Iterations; i++) {
+			buffer.seek(0);
+			QScopedPointer<QImageIOHandler> psdHandler(new QPsdHandler());
+			psdHandler->setDevice(&buffer);
+			if (psdHandler->canRead())
+				continue;
+			QScopedPointer<QImageIOHandler> tiffHandler(new QTiffHandler());
+			tiffHandler->setDevice(&buffer);
+			if (tiffHandler->canRead())
+				continue;
+			buffer.seek(0);
+			QImageReader reader(&buffer);
+			reader.setDecideFormatFromContent(true);
+			reader.canRead();
+		}
+		const qint64 probeTime = timer.nsecsElapsed() / Iterations;
+
+		// Signature dispatch as done by Image::load, QImageReader only for formats without own decoder
+		QByteArray format;
+		timer.restart();
+		for (int i = 0; i < Iterations; i++) {
+			buffer.seek(0);
+			format = instance().identify(data.left(HeaderSize));
+			QScopedPointer<QImageIOHandler> handler(instance().createHandler(format));
+			if (handler) {
+				handler->setDevice(&buffer);
+				if (handler->canRead())
+					continue;
+			}
+			buffer.seek(0);
+			QImageReader reader(&buffer);
+			reader.setDecideFormatFromContent(true);
+			reader.canRead();
+		}
+		const qint64 dispatchTime = timer.nsecsElapsed() / Iterations;
+
+		out << "Benchmark: " << fileName << ", format " << (format.isEmpty() ? QByteArray("auto") : format)
+			<< ": probe chain " << probeTime << " ns, signature dispatch " << dispatchTime << " ns" << Qt::endl;
+	}
+}
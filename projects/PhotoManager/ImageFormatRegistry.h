@@ -0,0 +1,47 @@
+#pragma once
+
+#include <QByteArray>
+#include <QVector>
+#include <QStringList>
+#include <QTextStream>
+#include <functional>
+
+class QImageIOHandler;
+
+// Identifies image format from the first bytes of file data and creates decoder registered for it.
+// Formats without own decoder are left to QImageReader.
+class ImageFormatRegistry
+{
+public:
+	typedef std::function<QImageIOHandler*()> HandlerFactory;
+
+	// Number of bytes from file start needed to identify any registered format
+	static const int HeaderSize = 16;
+
+	static ImageFormatRegistry& instance();
+
+	// Register decoder for files containing signature at offset. Not thread safe, register formats before decoding starts.
+	void registerFormat(const QByteArray& format, const QByteArray& signature, const HandlerFactory& factory, int offset = 0);
+
+	// Returns format matching file header, empty when no registered decoder recognizes the data
+	QByteArray identify(const QByteArray& header) const;
+
+	// Returns new decoder for format or nullptr, caller takes ownership
+	QImageIOHandler* createHandler(const QByteArray& format) const;
+
+	// Print timing of signature dispatch and of probing PSD, TIFF and QImageReader in turn for each file to out
+	static void benchmark(const QStringList& fileNames, QTextStream& out);
+
+private:
+	ImageFormatRegistry();
+
+	struct Format
+	{
+		QByteArray format;
+		QByteArray signature;
+		int offset = 0;
+		HandlerFactory factory;
+	};
+
+	QVector<Format> registryFormats;
+};
@@ -1,26 +1,85 @@
 #include "ImageProcessor.h"
 #include "ImageProcessorWorker.h"
+#include "JpegHandler.h"
 
 ImageProcessor::ImageProcessor(QObject* parent)
 	: QObject(parent)
 {
 	worker = new ImageProcessorWorker(this);
-	connect(worker, &ImageProcessorWorker::imageLoaded, this, &ImageProcessor::imageLoaded, Qt::QueuedConnection);
+	connect(worker, &ImageProcessorWorker::imageLoaded, this, &ImageProcessor::workerImageLoaded, Qt::QueuedConnection);
+	connect(worker, &ImageProcessorWorker::pyramidBuilt, this, &ImageProcessor::pyramidBuilt, Qt::QueuedConnection);
+
+	// Release cached images when other applications need the memory, even when nothing new is being decoded
+	connect(&memoryPressureTimer, &QTimer::timeout, worker, &ImageProcessorWorker::checkMemoryPressure);
+	memoryPressureTimer.start(2000);
 }
 
 ImageProcessor::~ImageProcessor()
 {}
 
-void ImageProcessor::loadImage(const QString& fileName)
+bool ImageProcessor::loadImage(const QString& fileName)
 {
 	if (fileName.isEmpty())
+		return false;
+	// Each navigation starts new generation, drop work scheduled for the previous image
+	worker->cancelPendingTasks();
+
+	// Cached image is shown directly, without waiting for a worker thread and a queued signal
+	ImageHandle image = worker->cachedImage(fileName);
+	if (image) {
+		emit imageLoaded(image);
+		return true;
+	}
+
+	worker->appendTask(ImageProcessorWorker::TaskLoadImage, fileName);
+	return false;
+}
+
+void ImageProcessor::workerImageLoaded(const ImageHandle& image, int generation)
+{
+	// Worker checked generation when queueing the signal, image shown from cache since then must not be replaced
+	if (generation != worker->generation())
 		return;
-	worker->appendTask(ImageProcessorWorker::TaskLoadImage, 0, fileName, true);
+	emit imageLoaded(image);
 }
 
-void ImageProcessor::preloadImage(const QString& fileName)
+void ImageProcessor::loadFullImage(const QString& fileName)
 {
 	if (fileName.isEmpty())
 		return;
-	worker->appendTask(ImageProcessorWorker::TaskPreloadImage, 0, fileName, false);
+	worker->appendTask(ImageProcessorWorker::TaskLoadFullImage, fileName);
+}
+
+void ImageProcessor::buildPyramid(const ImageHandle& image)
+{
+	if (!image || image->pyramid() == nullptr)
+		return;
+	worker->appendTask(ImageProcessorWorker::TaskBuildPyramid, QVariant::fromValue(image));
+}
+
+void ImageProcessor::preloadImage(const QString& fileName, int distance)
+{
+	if (fileName.isEmpty())
+		return;
+	worker->appendTask(ImageProcessorWorker::TaskPreloadImage, fileName, qMax(1, distance));
+}
+
+int ImageProcessor::cacheCapacity() const
+{
+	return worker->estimatedCacheCapacity();
+}
+
+void ImageProcessor::setTargetSize(const QSize& size)
+{
+	worker->setTargetSize(size);
+}
+
+void ImageProcessor::setParallelJpegDecoding(bool enabled)
+{
+	JpegHandler::setParallelDecoding(enabled);
+}
+
+void ImageProcessor::setCacheSize(qint64 bytes, qint64 fileDataBytes)
+{
+	worker->setCacheSize(bytes, fileDataBytes);
 }
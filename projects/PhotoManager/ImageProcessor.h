@@ -1,6 +1,7 @@
 #pragma once
 
 #include <QObject>
+#include <QTimer>
 #include "Image.h"
 
 class ImageProcessorWorker;
@@ -14,12 +15,39 @@ public:
 	ImageProcessor(QObject* parent = nullptr);
 	~ImageProcessor();
 
-	void loadImage(const QString& fileName);
-	void preloadImage(const QString& fileName);
+	// Decode image and emit imageLoaded. Cancels all work requested before, preloads must be requested again.
+	// Returns true when the image was found in cache and imageLoaded has already been emitted.
+	bool loadImage(const QString& fileName);
+
+	// Decode image at full resolution and emit imageLoaded, used when displayed image was decoded at reduced resolution
+	void loadFullImage(const QString& fileName);
+
+	// Build pyramid of image in the background and emit pyramidBuilt, used when displayed image is zoomed out
+	void buildPyramid(const ImageHandle& image);
+
+	// Decode image into cache in the background. Images closer to the current one (lower distance) are decoded first.
+	void preloadImage(const QString& fileName, int distance = 1);
+
+	// Set size images are displayed at when fitted to screen. Images much larger than that may be decoded at reduced resolution.
+	void setTargetSize(const QSize& size);
+
+	// Enable decoding of large JPEGs with restart markers on several threads, compare timing in debug output
+	void setParallelJpegDecoding(bool enabled);
+
+	// Returns estimated number of images which can be held in cache
+	int cacheCapacity() const;
+
+	// Set memory budget for decoded images and for raw file data kept to avoid repeated disk reads, in bytes
+	void setCacheSize(qint64 bytes, qint64 fileDataBytes);
 
 signals:
-	void imageLoaded(const Image& image);
+	void imageLoaded(const ImageHandle& image);
+	void pyramidBuilt(const ImageHandle& image);
+
+private:
+	void workerImageLoaded(const ImageHandle& image, int generation);
 
 private:
 	ImageProcessorWorker* worker;
+	QTimer memoryPressureTimer;
 };
@@ -1,53 +1,151 @@
 #include "ImageProcessorWorker.h"
+#include <QThread>
 #include <QMutex>
 #include <QWaitCondition>
+#include <QElapsedTimer>
 #include <QDebug>
+#include "ImagePyramid.h"
 
 ImageProcessorWorker::ImageProcessorWorker(QObject* parent)
-	: QThread(parent), cache(1024)
+	: QObject(parent)
 {
 	qRegisterMetaType<TaskData>();
-	qRegisterMetaType<Image>();
+	qRegisterMetaType<ImageHandle>();
 
 	mutex = new QMutex();
 	waitCondition = new QWaitCondition();
-	start();
+
+	// Leave one core for the user interface thread
+	const int threadCount = qMax(1, QThread::idealThreadCount() - 1);
+	for (int i = 0; i < threadCount; i++) {
+		QThread* thread = QThread::create([this]() { run(); });
+		thread->setObjectName(QString("ImageProcessorWorker %1").arg(i));
+		threads.append(thread);
+		thread->start();
+	}
+	qDebug() << "Image decoding threads:" << threadCount;
 }
 
 ImageProcessorWorker::~ImageProcessorWorker()
 {
-	requestInterruption();
+	mutex->lock();
+	for (QThread* thread : threads)
+		thread->requestInterruption();
 	waitCondition->wakeAll();
-	wait();
+	mutex->unlock();
+
+	for (QThread* thread : threads) {
+		thread->wait();
+		delete thread;
+	}
 	delete mutex;
 	delete waitCondition;
 }
 
-void ImageProcessorWorker::appendTask(TaskType type, int id, const QVariant& data, bool removePrevious)
+void ImageProcessorWorker::appendTask(TaskType type, const QVariant& data, int priority)
 {
 	mutex->lock();
-	if (removePrevious) {
+	TaskData task;
+	task.generation = currentGeneration.loadRelaxed();
+	task.type = type;
+	task.data = data;
+	task.priority = priority;
+
+	const QString fileName = taskFileName(task);
+	currentGenerationFiles.insert(fileName);
+
+	if (type == TaskLoadFullImage || type == TaskBuildPyramid) {
+		// Full resolution decode and pyramid run next to reduced decodes of the same file, only repeated requests are merged
+		for (const TaskData& queuedTask : tasks) {
+			if (queuedTask.type == type && taskFileName(queuedTask) == fileName) {
+				mutex->unlock();
+				return;
+			}
+		}
+	} else {
+		// Image is already being decoded, attach load request to the running decode instead of queueing it again
+		if (inFlightFiles.contains(fileName)) {
+			if (type == TaskLoadImage)
+				inFlightFiles[fileName] = task.generation;
+			mutex->unlock();
+			return;
+		}
+
+		// Merge with queued task for the same file, keep the more urgent one
 		for (int i = 0; i < tasks.count(); i++) {
-			if (tasks.at(i).id == id) {
-				tasks.removeAt(i);
-				i--;
+			const TaskData& queuedTask = tasks.at(i);
+			if (queuedTask.data.toString() != fileName || queuedTask.type == TaskLoadFullImage || queuedTask.type == TaskBuildPyramid)
+				continue;
+			if (queuedTask.type == TaskLoadImage || (type == TaskPreloadImage && queuedTask.priority <= priority)) {
+				mutex->unlock();
+				return;
 			}
+			tasks.removeAt(i);
+			break;
 		}
 	}
-	TaskData task;
-	task.id = id;
-	task.type = type;
-	task.data = data;
-	
-	tasks.append(task);
+
+	// Keep queue sorted by priority, new task goes after all tasks with the same priority
+	int index = tasks.count();
+	while (index > 0 && tasks.at(index - 1).priority > priority)
+		index--;
+	tasks.insert(index, task);
 	mutex->unlock();
-	waitCondition->wakeAll();
+	waitCondition->wakeOne();
+}
+
+void ImageProcessorWorker::cancelPendingTasks()
+{
+	mutex->lock();
+	currentGeneration.fetchAndAddRelaxed(1);
+	currentGenerationFiles.clear();
+	tasks.clear();
+	mutex->unlock();
+}
+
+ImageHandle ImageProcessorWorker::cachedImage(const QString& fileName)
+{
+	return cache.object(fileName);
+}
+
+int ImageProcessorWorker::estimatedCacheCapacity() const
+{
+	// Size of 24 MP image, used until something is cached
+	static const qint64 DefaultImageCost = 24LL * 1000 * 1000 * 4;
+
+	qint64 averageCost = DefaultImageCost;
+	const int count = cache.count();
+	if (count > 0)
+		averageCost = qMax<qint64>(1, cache.totalCost() / count);
+	return static_cast<int>(cache.maxCost() / averageCost);
+}
+
+void ImageProcessorWorker::setTargetSize(const QSize& size)
+{
+	QMutexLocker locker(mutex);
+	decodeTargetSize = size;
+}
+
+void ImageProcessorWorker::setCacheSize(qint64 bytes, qint64 fileDataBytes)
+{
+	cache.setMaxCost(bytes);
+	cache.setFileDataMaxCost(fileDataBytes);
+}
+
+void ImageProcessorWorker::checkMemoryPressure()
+{
+	cache.checkMemoryPressure();
 }
 
 void ImageProcessorWorker::run()
 {
-	while (!isInterruptionRequested()) {
+	QThread* thread = QThread::currentThread();
+	while (true) {
 		mutex->lock();
+		if (thread->isInterruptionRequested()) {
+			mutex->unlock();
+			break;
+		}
 		if (tasks.isEmpty()) {
 			// Wait for more requests
 			waitCondition->wait(mutex);
@@ -62,35 +160,171 @@ void ImageProcessorWorker::run()
 
 void ImageProcessorWorker::processTask(const TaskData& task)
 {
+	if (isTaskCancelled(task))
+		return;
+
 	switch (task.type) {
 		case TaskLoadImage:
-			taskLoadImage(task.data.toString());
+			taskLoadImage(task);
 			break;
 		case TaskPreloadImage:
-			taskPreloadImage(task.data.toString());
+			taskPreloadImage(task);
+			break;
+		case TaskLoadFullImage:
+			taskLoadFullImage(task);
+			break;
+		case TaskBuildPyramid:
+			taskBuildPyramid(task);
 			break;
 	}
 }
 
-void ImageProcessorWorker::taskLoadImage(const QString& fileName)
+void ImageProcessorWorker::taskLoadImage(const TaskData& task)
 {
-	if (cache.contains(fileName)) {
-		Image* image = cache.object(fileName);
-		emit imageLoaded(*image);
-	} else {
-		Image* image = new Image();
-		image->load(fileName);
-		cache.insert(image->absoluteFilePath(), image, image->cacheSize());
-		emit imageLoaded(*image);
+	const QString fileName = task.data.toString();
+
+	mutex->lock();
+	ImageHandle image = cache.object(fileName);
+	if (image) {
+		bool isRequested = (task.generation == currentGeneration.loadRelaxed());
+		mutex->unlock();
+		if (isRequested)
+			emit imageLoaded(image, task.generation);
+		return;
+	}
+	if (inFlightFiles.contains(fileName)) {
+		// Another thread is decoding the same file, it emits the result when finished
+		inFlightFiles[fileName] = task.generation;
+		mutex->unlock();
+		return;
+	}
+	inFlightFiles.insert(fileName, task.generation);
+	mutex->unlock();
+
+	decodeImage(task);
+}
+
+void ImageProcessorWorker::taskPreloadImage(const TaskData& task)
+{
+	const QString fileName = task.data.toString();
+
+	mutex->lock();
+	if (cache.contains(fileName) || inFlightFiles.contains(fileName)) {
+		mutex->unlock();
+		return;
 	}
+	inFlightFiles.insert(fileName, -1);
+	mutex->unlock();
+
+	decodeImage(task);
+}
+
+void ImageProcessorWorker::taskLoadFullImage(const TaskData& task)
+{
+	const QString fileName = task.data.toString();
+
+	mutex->lock();
+	ImageHandle image = cache.object(fileName);
+	if (image && image->isFullResolution()) {
+		bool isRequested = (task.generation == currentGeneration.loadRelaxed());
+		mutex->unlock();
+		if (isRequested)
+			emit imageLoaded(image, task.generation);
+		return;
+	}
+	mutex->unlock();
+
+	decodeImage(task);
 }
 
-void ImageProcessorWorker::taskPreloadImage(const QString& fileName)
+void ImageProcessorWorker::taskBuildPyramid(const TaskData& task)
 {
-	if (cache.contains(fileName))
+	ImageHandle image = task.data.value<ImageHandle>();
+	ImagePyramid* pyramid = image ? image->pyramid() : nullptr;
+	if (pyramid == nullptr)
 		return;
 
-	Image* image = new Image();
-	image->load(fileName);
-	cache.insert(image->absoluteFilePath(), image, image->cacheSize());
+	QElapsedTimer timer;
+	timer.start();
+	if (!pyramid->build(image->image(), [this, &task]() { return isTaskCancelled(task); }))
+		return;
+	qDebug() << "Pyramid built in:" << timer.elapsed() << "ms," << image->fileName();
+
+	if (task.generation == currentGeneration.loadRelaxed())
+		emit pyramidBuilt(image);
+}
+
+void ImageProcessorWorker::decodeImage(const TaskData& task)
+{
+	const QString fileName = task.data.toString();
+
+	// Image evicted from decoded tier may still have its file data cached
+	QByteArray cachedFileData;
+	cache.fileData(fileName, &cachedFileData);
+
+	QSize targetSize;
+	if (task.type != TaskLoadFullImage) {
+		QMutexLocker locker(mutex);
+		targetSize = decodeTargetSize;
+	}
+
+	QSharedPointer<Image> image(new Image());
+	if (task.type == TaskLoadImage) {
+		// Embedded preview is shown while the image is decoded, as long as it is still requested
+		image->setPreviewHandler([this, fileName](const ImageHandle& preview) {
+			mutex->lock();
+			const int generation = inFlightFiles.value(fileName, -1);
+			bool isRequested = (generation == currentGeneration.loadRelaxed());
+			mutex->unlock();
+			if (isRequested)
+				emit imageLoaded(preview, generation);
+		});
+	}
+	bool isLoaded = image->load(fileName, [this, &task]() { return isTaskCancelled(task); }, cachedFileData, targetSize);
+
+	// Keep file data in separate tier, decoded image is cached without it. Going back to evicted image skips the disk
+	// (or network share) read. Mapped data is copied to the heap only for files below the large file size which fit
+	// the tier budget, large files keep peak memory at decoded pixels and are read again when needed.
+	// Frame sequences do not keep mappings, their data is already on the heap and shared with the tier.
+	QByteArray fileData;
+	if (isLoaded && !image->isFileDataMapped())
+		fileData = image->data();
+	else if (isLoaded && image->data().size() < Image::LargeFileSize && image->data().size() <= cache.fileDataMaxCost())
+		fileData = QByteArray(image->data().constData(), image->data().size());
+	image->releaseFileData();
+
+	mutex->lock();
+	// Full resolution decodes are not registered as in flight, they emit to the generation which requested them
+	int emitGeneration = (task.type == TaskLoadFullImage) ? task.generation : inFlightFiles.take(fileName);
+	if (isLoaded) {
+		// Newer load request could have finished sooner on another thread, do not replace it
+		if (emitGeneration == currentGeneration.loadRelaxed())
+			emit imageLoaded(image, emitGeneration);
+
+		// Do not replace full resolution image with reduced one decoded in parallel
+		ImageHandle cachedImage = cache.object(fileName);
+		if (image->isFullResolution() || !cachedImage || !cachedImage->isFullResolution())
+			cache.insert(fileName, image, image->cacheSize());
+		cache.insertFileData(fileName, fileData);
+	}
+	mutex->unlock();
+}
+
+bool ImageProcessorWorker::isTaskCancelled(const TaskData& task) const
+{
+	// Called from decoders for every block of data, avoid locking while generation is current
+	if (task.generation == currentGeneration.loadRelaxed())
+		return false;
+
+	QMutexLocker locker(mutex);
+	return !currentGenerationFiles.contains(taskFileName(task));
+}
+
+QString ImageProcessorWorker::taskFileName(const TaskData& task)
+{
+	if (task.type == TaskBuildPyramid) {
+		ImageHandle image = task.data.value<ImageHandle>();
+		return image ? image->absoluteFilePath() : QString();
+	}
+	return task.data.toString();
 }
@@ -1,15 +1,20 @@
 #pragma once
 
-#include <QThread>
+#include <QObject>
 #include <QVariant>
 #include <QVector>
-#include <QCache>
+#include <QSet>
+#include <QHash>
+#include <QAtomicInt>
+#include <QSize>
 #include "Image.h"
+#include "ImageCache.h"
 
 class QMutex;
 class QWaitCondition;
+class QThread;
 
-class ImageProcessorWorker : public QThread
+class ImageProcessorWorker : public QObject
 {
 	Q_OBJECT
 
@@ -18,38 +23,80 @@ public:
 	{
 		TaskLoadImage,
 		TaskPreloadImage,
+		TaskLoadFullImage,
+		TaskBuildPyramid,
 	};
 
 	struct TaskData
 	{
-		int id;
+		int generation;
 		TaskType type;
 		QVariant data;
+		int priority;
 
-		TaskData() : id(0) {}
+		TaskData() : generation(0), priority(0) {}
 	};
 
 	ImageProcessorWorker(QObject* parent = nullptr);
 	~ImageProcessorWorker();
 
-	void appendTask(TaskType type, int id, const QVariant& data, bool removePrevious);
+	// Queue new task. Tasks with lower priority value are processed first, tasks with equal priority in order of arrival.
+	// Data is file name, pyramid is built for image handle.
+	void appendTask(TaskType type, const QVariant& data, int priority = 0);
+
+	// Start new generation of tasks. Queued tasks are dropped and running tasks are interrupted
+	// unless the same file is requested again in the new generation.
+	void cancelPendingTasks();
+
+	// Returns generation started by the last cancelPendingTasks
+	int generation() const { return currentGeneration.loadRelaxed(); }
+
+	// Returns decoded image from cache or null handle. Safe to call from any thread, does not touch the task queue.
+	ImageHandle cachedImage(const QString& fileName);
+
+	// Returns number of threads decoding images in parallel
+	int threadCount() const { return threads.count(); }
+
+	// Returns estimated number of images which fit into the cache, based on size of already cached images
+	int estimatedCacheCapacity() const;
+
+	// Set size images are displayed at when fitted to screen, invalid size always decodes full resolution
+	void setTargetSize(const QSize& size);
+
+	// Set memory budget of decoded images and of raw file data in bytes
+	void setCacheSize(qint64 bytes, qint64 fileDataBytes);
+
+	// Shrink cache when system is low on memory
+	void checkMemoryPressure();
 
 signals:
-	void imageLoaded(const Image& image);
+	// Generation is the one which requested the image, delivery queued before newer navigation is stale
+	void imageLoaded(const ImageHandle& image, int generation);
+	void pyramidBuilt(const ImageHandle& image);
 
 protected:
 	void run();
 	void processTask(const TaskData& task);
 
 private:
-	void taskLoadImage(const QString& fileName);
-	void taskPreloadImage(const QString& fileName);
+	void taskLoadImage(const TaskData& task);
+	void taskPreloadImage(const TaskData& task);
+	void taskLoadFullImage(const TaskData& task);
+	void taskBuildPyramid(const TaskData& task);
+	void decodeImage(const TaskData& task);
+	static QString taskFileName(const TaskData& task);
+	bool isTaskCancelled(const TaskData& task) const;
 
 private:
 	QMutex* mutex;
 	QWaitCondition* waitCondition;
+	QVector<QThread*> threads;
 	QVector<TaskData> tasks;
-	QCache<QString, Image> cache;
+	ImageCache cache;
+	QSize decodeTargetSize;
+	QAtomicInt currentGeneration;
+	QSet<QString> currentGenerationFiles;
+	QHash<QString, int> inFlightFiles; // File name -> generation which should receive imageLoaded, -1 when only preloading
 };
 
 Q_DECLARE_METATYPE(ImageProcessorWorker::TaskData);
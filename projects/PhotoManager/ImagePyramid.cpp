@@ -0,0 +1,93 @@
+#include "ImagePyramid.h"
+#include <QMutexLocker>
+
+namespace
+{
+	// Rounded average of four pixels, computed for each byte separately
+	inline quint32 average4(quint32 p0, quint32 p1, quint32 p2, quint32 p3)
+	{
+		const quint32 high = ((p0 & 0xFCFCFCFC) >> 2) + ((p1 & 0xFCFCFCFC) >> 2) + ((p2 & 0xFCFCFCFC) >> 2) + ((p3 & 0xFCFCFCFC) >> 2);
+		const quint32 low = (((p0 & 0x03030303) + (p1 & 0x03030303) + (p2 & 0x03030303) + (p3 & 0x03030303) + 0x02020202) >> 2) & 0x03030303;
+		return high + low;
+	}
+
+	// Returns image of half size, odd last row and column are dropped
+	QImage halve(const QImage& image)
+	{
+		const int width = image.width() / 2;
+		const int height = image.height() / 2;
+
+		// Display formats are averaged directly, premultiplied alpha averages correctly per byte
+		if (image.format() == QImage::Format_RGB32 || image.format() == QImage::Format_ARGB32_Premultiplied) {
+			QImage half(width, height, image.format());
+			for (int y = 0; y < height; y++) {
+				const quint32* line0 = reinterpret_cast<const quint32*>(image.constScanLine(2 * y));
+				const quint32* line1 = reinterpret_cast<const quint32*>(image.constScanLine(2 * y + 1));
+				quint32* target = reinterpret_cast<quint32*>(half.scanLine(y));
+				for (int x = 0; x < width; x++)
+					target[x] = average4(line0[2 * x], line0[2 * x + 1], line1[2 * x], line1[2 * x + 1]);
+			}
+			return half;
+		}
+		if (image.format() == QImage::Format_Grayscale8) {
+			QImage half(width, height, image.format());
+			for (int y = 0; y < height; y++) {
+				const uchar* line0 = image.constScanLine(2 * y);
+				const uchar* line1 = image.constScanLine(2 * y + 1);
+				uchar* target = half.scanLine(y);
+				for (int x = 0; x < width; x++)
+					target[x] = uchar((line0[2 * x] + line0[2 * x + 1] + line1[2 * x] + line1[2 * x + 1] + 2) >> 2);
+			}
+			return half;
+		}
+		return image.scaled(width, height, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+	}
+}
+
+bool ImagePyramid::isUseful(const QSize& size)
+{
+	return size.width() / 2 >= MinLevelSize && size.height() / 2 >= MinLevelSize;
+}
+
+bool ImagePyramid::build(const QImage& image, const std::function<bool()>& isCancelled)
+{
+	// Viewer keeps reading levels while they are built, only publishing them takes the main lock
+	QMutexLocker buildLocker(&buildMutex);
+	if (isBuilt())
+		return true;
+
+	QVector<QImage> levels;
+	QImage level = image;
+	while (isUseful(level.size())) {
+		if (isCancelled && isCancelled())
+			return false;
+		level = halve(level);
+		levels.append(level);
+	}
+
+	QMutexLocker locker(&mutex);
+	pyramidLevels = levels;
+	pyramidBaseSize = image.size();
+	pyramidBuilt = true;
+	return true;
+}
+
+bool ImagePyramid::isBuilt() const
+{
+	QMutexLocker locker(&mutex);
+	return pyramidBuilt;
+}
+
+QImage ImagePyramid::level(double scale, double* levelScale) const
+{
+	QMutexLocker locker(&mutex);
+	QImage bestLevel;
+	for (const QImage& level : pyramidLevels) {
+		const double currentScale = double(level.width()) / pyramidBaseSize.width();
+		if (currentScale < scale)
+			break;
+		bestLevel = level;
+		*levelScale = currentScale;
+	}
+	return bestLevel;
+}
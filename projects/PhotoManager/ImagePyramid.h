@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QImage>
+#include <QVector>
+#include <QMutex>
+#include <functional>
+
+// Half resolution levels of a bitmap, zoomed out views are scaled from the nearest larger level instead of the full bitmap.
+// Levels are built once on a worker thread, until then the bitmap itself is the only source. Safe to use from multiple threads.
+class ImagePyramid
+{
+public:
+	// Levels are built down to this size, smaller views are scaled from the smallest level
+	static const int MinLevelSize = 256;
+
+	// Returns true when bitmap of size is large enough to have at least one level
+	static bool isUseful(const QSize& size);
+
+	// Returns memory used by all levels of bitmap taking frameSize bytes
+	static qint64 maximumCost(qint64 frameSize) { return frameSize / 3; }
+
+	// Build levels from bitmap by averaging 2x2 pixel blocks, does nothing when already built. Returns false when cancelled.
+	bool build(const QImage& image, const std::function<bool()>& isCancelled = nullptr);
+
+	bool isBuilt() const;
+
+	// Returns smallest level at least scale times the size of bitmap and stores its scale relative to bitmap to levelScale.
+	// Returns null image when bitmap itself should be scaled.
+	QImage level(double scale, double* levelScale) const;
+
+private:
+	mutable QMutex mutex;
+	QMutex buildMutex;
+	QVector<QImage> pyramidLevels; // Level i has 1/2^(i+1) of bitmap size
+	QSize pyramidBaseSize;
+	bool pyramidBuilt = false;
+};
@@ -0,0 +1,239 @@
+#include "ImageScaler.h"
+#include <QVector>
+#include <QImageReader>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <qsimd.h>
+#include <cmath>
+#include <limits>
+#include "DisplayFormat.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	// Smaller images are scaled faster than threads are started
+	const qint64 ParallelMinPixels = 2LL * 1000 * 1000;
+
+	// Source pixels contributing to one target pixel along one axis, weights sum to 1
+	struct Contribution
+	{
+		int first = 0;
+		QVector<float> weights;
+	};
+
+	// Returns contributions of source pixels to target pixels of axis from first, count pixels
+	QVector<Contribution> contributions(int sourceSize, int targetSize, int first, int count)
+	{
+		const double ratio = double(sourceSize) / targetSize;
+		QVector<Contribution> result(count);
+		for (int i = first; i < first + count; i++) {
+			Contribution& contribution = result[i - first];
+			if (ratio >= 2.0) {
+				// Area average, edge pixels contribute by the part covered by target pixel
+				const double begin = i * ratio;
+				const double end = qMin<double>((i + 1) * ratio, sourceSize);
+				contribution.first = int(begin);
+				for (int s = contribution.first; s < end; s++)
+					contribution.weights.append(float((qMin<double>(s + 1, end) - qMax<double>(s, begin)) / (end - begin)));
+			} else {
+				// Bilinear between two nearest source pixel centers
+				const double center = qBound(0.0, (i + 0.5) * ratio - 0.5, double(sourceSize - 1));
+				contribution.first = qMin(int(center), sourceSize - 2);
+				const float fraction = float(center - contribution.first);
+				contribution.weights << 1.0f - fraction << fraction;
+			}
+		}
+		return result;
+	}
+
+	// Horizontal pass of one 32-bit source line into 4 float channels per target pixel
+	void filterLine32(const uchar* line, const QVector<Contribution>& columns, float* target)
+	{
+		for (int x = 0; x < columns.count(); x++) {
+			const Contribution& column = columns.at(x);
+			const quint32* pixels = reinterpret_cast<const quint32*>(line) + column.first;
+#ifdef __SSE2__
+			const __m128i zero = _mm_setzero_si128();
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < column.weights.count(); k++) {
+				__m128i pixel = _mm_cvtsi32_si128(int(pixels[k]));
+				pixel = _mm_unpacklo_epi16(_mm_unpacklo_epi8(pixel, zero), zero);
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_cvtepi32_ps(pixel), _mm_set1_ps(column.weights.at(k))));
+			}
+			_mm_storeu_ps(target + 4 * x, sum);
+#else
+			float sum[4] = { 0, 0, 0, 0 };
+			for (int k = 0; k < column.weights.count(); k++) {
+				const uchar* pixel = reinterpret_cast<const uchar*>(pixels + k);
+				for (int c = 0; c < 4; c++)
+					sum[c] += pixel[c] * column.weights.at(k);
+			}
+			for (int c = 0; c < 4; c++)
+				target[4 * x + c] = sum[c];
+#endif
+		}
+	}
+
+	// Horizontal pass of one 8-bit source line
+	void filterLine8(const uchar* line, const QVector<Contribution>& columns, float* target)
+	{
+		for (int x = 0; x < columns.count(); x++) {
+			const Contribution& column = columns.at(x);
+			float sum = 0;
+			for (int k = 0; k < column.weights.count(); k++)
+				sum += line[column.first + k] * column.weights.at(k);
+			target[x] = sum;
+		}
+	}
+
+	// Add weighted horizontally filtered line to accumulated target line
+	void accumulate(float* accumulator, const float* line, float weight, int count)
+	{
+		int i = 0;
+#ifdef __SSE2__
+		const __m128 w = _mm_set1_ps(weight);
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_ps(accumulator + i, _mm_add_ps(_mm_loadu_ps(accumulator + i), _mm_mul_ps(_mm_loadu_ps(line + i), w)));
+#endif
+		for (; i < count; i++)
+			accumulator[i] += line[i] * weight;
+	}
+
+	// Round accumulated channels to bytes of target line
+	void storeLine(const float* accumulator, uchar* target, int count)
+	{
+		int i = 0;
+#ifdef __SSE2__
+		for (; i + 4 <= count; i += 4) {
+			const __m128i values = _mm_cvtps_epi32(_mm_loadu_ps(accumulator + i));
+			const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(values, values), _mm_setzero_si128());
+			*reinterpret_cast<quint32*>(target + i) = quint32(_mm_cvtsi128_si32(bytes));
+		}
+#endif
+		for (; i < count; i++)
+			target[i] = uchar(qBound(0, int(accumulator[i] + 0.5f), 255));
+	}
+
+	// Scale target lines from firstLine up to lastLine (exclusive)
+	void scaleBand(const QImage& image, const QVector<Contribution>& columns, const QVector<Contribution>& rows,
+		int firstLine, int lastLine, uchar* bits, qsizetype bytesPerLine)
+	{
+		const int channels = image.depth() / 8;
+		const int count = columns.count() * channels;
+		QVector<float> line(count);
+		QVector<float> accumulator(count);
+
+		for (int y = firstLine; y < lastLine; y++) {
+			const Contribution& row = rows.at(y);
+			accumulator.fill(0);
+			for (int k = 0; k < row.weights.count(); k++) {
+				if (channels == 4)
+					filterLine32(image.constScanLine(row.first + k), columns, line.data());
+				else
+					filterLine8(image.constScanLine(row.first + k), columns, line.data());
+				accumulate(accumulator.data(), line.constData(), row.weights.at(k), count);
+			}
+			storeLine(accumulator.constData(), bits + y * bytesPerLine, count);
+		}
+	}
+}
+
+QImage ImageScaler::scaled(const QImage& image, const QSize& size)
+{
+	return scaled(image, size, QRect(QPoint(0, 0), size));
+}
+
+QImage ImageScaler::scaled(const QImage& image, const QSize& size, const QRect& rect)
+{
+	const QRect area = rect.intersected(QRect(QPoint(0, 0), size));
+	const bool hasKernel = (image.format() == QImage::Format_RGB32 || image.format() == QImage::Format_ARGB32_Premultiplied || image.format() == QImage::Format_Grayscale8);
+	if (!hasKernel || area.isEmpty() || size.width() > image.width() || size.height() > image.height() || image.width() < 2 || image.height() < 2) {
+		const QImage result = image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+		return (area.size() == size) ? result : result.copy(area);
+	}
+
+	// Contributions are computed for the whole target axes, rects of the same size join without seams
+	const QVector<Contribution> columns = contributions(image.width(), size.width(), area.x(), area.width());
+	const QVector<Contribution> rows = contributions(image.height(), size.height(), area.y(), area.height());
+
+	// Bands write to distinct lines of the image, bits are taken once so that threads do not detach it
+	QImage result(area.size(), image.format());
+	uchar* bits = result.bits();
+	const qsizetype bytesPerLine = result.bytesPerLine();
+
+	const qint64 sourcePixels = qint64(image.width()) * image.height() * area.width() / size.width() * area.height() / size.height();
+	if (sourcePixels < ParallelMinPixels) {
+		scaleBand(image, columns, rows, 0, area.height(), bits, bytesPerLine);
+		return result;
+	}
+
+	const int bandCount = qMin(area.height(), QThreadPool::globalInstance()->maxThreadCount());
+	QVector<int> bands;
+	for (int i = 0; i < bandCount; i++)
+		bands.append(i);
+
+	QtConcurrent::blockingMap(bands, [&](int band) {
+		const int firstLine = band * area.height() / bandCount;
+		const int lastLine = (band + 1) * area.height() / bandCount;
+		scaleBand(image, columns, rows, firstLine, lastLine, bits, bytesPerLine);
+	});
+	return result;
+}
+
+QImage ImageScaler::subImage(const QImage& image, const QRect& rect)
+{
+	const QRect area = rect.intersected(image.rect());
+	if (area == image.rect())
+		return image;
+
+	// Bit packed formats do not start lines at byte boundary
+	if (image.depth() < 8 || area.isEmpty())
+		return image.copy(area);
+
+	const uchar* bits = image.constScanLine(area.y()) + area.x() * (image.depth() / 8);
+	QImage view(bits, area.width(), area.height(), image.bytesPerLine(), image.format());
+	view.setColorTable(image.colorTable());
+	view.setDevicePixelRatio(image.devicePixelRatio());
+	return view;
+}
+
+void ImageScaler::benchmark(const QStringList& fileNames, QTextStream& out)
+{
+	static const int Factors[] = { 2, 3, 4, 6, 8, 16 };
+	static const int Runs = 5;
+
+	for (const QString& fileName : fileNames) {
+		QImageReader reader(fileName);
+		reader.setAutoTransform(true);
+		const QImage image = DisplayFormat::convert(reader.read());
+		if (image.isNull()) {
+			out << "Benchmark cannot read: " << fileName << Qt::endl;
+			continue;
+		}
+		out << "Benchmark: " << fileName << " " << image.width() << "x" << image.height() << ", " << image.depth() << " bpp" << Qt::endl;
+
+		for (int factor : Factors) {
+			const QSize size(qMax(1, image.width() / factor), qMax(1, image.height() / factor));
+
+			// Best of several runs, the first one includes thread pool start-up and cold caches
+			qint64 kernelTime = std::numeric_limits<qint64>::max();
+			qint64 qtTime = std::numeric_limits<qint64>::max();
+			for (int run = 0; run < Runs; run++) {
+				QElapsedTimer timer;
+				timer.start();
+				const QImage kernelResult = scaled(image, size);
+				kernelTime = qMin(kernelTime, timer.nsecsElapsed() / 1000);
+
+				timer.restart();
+				const QImage qtResult = image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+				qtTime = qMin(qtTime, timer.nsecsElapsed() / 1000);
+			}
+
+			out << "  1/" << factor << ": ImageScaler " << kernelTime << " us, QImage::scaled " << qtTime << " us" << Qt::endl;
+		}
+	}
+}
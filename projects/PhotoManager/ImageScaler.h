@@ -0,0 +1,24 @@
+#pragma once
+
+#include <QImage>
+#include <QStringList>
+#include <QTextStream>
+
+// Downscales display format images (RGB32, premultiplied ARGB32 and Grayscale8). Reductions of 2x and more average
+// the covered source area, smaller reductions interpolate bilinearly. Large images are split into bands scaled in parallel.
+class ImageScaler
+{
+public:
+	// Returns image scaled to exactly size, formats without own kernel and enlargements are scaled by QImage
+	static QImage scaled(const QImage& image, const QSize& size);
+
+	// Returns rect of image scaled to size, pixels are the same as in the rect of the whole scaled image
+	static QImage scaled(const QImage& image, const QSize& size, const QRect& rect);
+
+	// Returns read only image sharing pixels of rect in image, lines are read in place with the stride of image.
+	// Valid only while image exists, result of operations returning it unchanged must be copied before keeping it.
+	static QImage subImage(const QImage& image, const QRect& rect);
+
+	// Print best of several runs of scaled() and QImage::scaled for several reduction factors of each file to out
+	static void benchmark(const QStringList& fileNames, QTextStream& out);
+};
@@ -8,19 +8,50 @@
 #include <QWheelEvent>
 #include <QTextDocument>
 #include <QAbstractTextDocumentLayout>
+#include <QTransform>
+#include <QtMath>
 #include <QDebug>
+#include <cmath>
+#include <limits>
+#include "ImagePyramid.h"
+#include "ImageScaler.h"
+#include "BackgroundRenderer.h"
+
+namespace
+{
+	// Returns smallest rect covering rect scaled by factor
+	QRect scaledCoveringRect(const QRect& rect, double factor)
+	{
+		return QRect(QPoint(qFloor(rect.x() * factor), qFloor(rect.y() * factor)),
+			QPoint(qCeil((rect.right() + 1) * factor) - 1, qCeil((rect.bottom() + 1) * factor) - 1));
+	}
+}
 
 ImageViewerWidget::ImageViewerWidget(QWidget* parent)
 	: QWidget(parent)
 {
 	imageZoomLevel = 1.0;
 	imageRotation = 0;
+	currentFrameIndex = 0;
+	baseImage = ImageHandle(new Image());
 	isMouseMovementActive = false;
 	showImageInformation = true;
 	currentImageNumber = 0;
 	currentImageCount = 0;
+	setTileCacheSize(128 * 1024 * 1024);
+	backgroundRenderer = new BackgroundRenderer(this);
+	connect(backgroundRenderer, &BackgroundRenderer::rendered, this, &ImageViewerWidget::backgroundRendered);
+	connect(backgroundRenderer, &BackgroundRenderer::tileRendered, this, &ImageViewerWidget::backgroundTileRendered);
+
+	// Whole viewport is painted in paintEvent, background does not need to be erased before partial repaints
+	setAttribute(Qt::WA_OpaquePaintEvent);
 	connect(&animationTimer, &QTimer::timeout, this, &ImageViewerWidget::switchToNextAnimationFrame);
 	animationTimer.setSingleShot(true);
+	connect(&frameDecodeTimer, &QTimer::timeout, this, [this]() { stepToFrame(pendingFrameIndex); });
+	frameDecodeTimer.setSingleShot(true);
+	connect(&interactionIdleTimer, &QTimer::timeout, this, &ImageViewerWidget::interactionIdle);
+	interactionIdleTimer.setSingleShot(true);
+	setInteractionIdleTime(150);
 }
 
 ImageViewerWidget::~ImageViewerWidget()
@@ -28,24 +59,45 @@ ImageViewerWidget::~ImageViewerWidget()
 	invalidateCache();
 }
 
-void ImageViewerWidget::setImage(const Image& image)
+void ImageViewerWidget::setImage(const ImageHandle& image)
 {
+	if (!image)
+		return;
+
+	// Decoded image replacing its preview or full resolution of displayed image arrived, keep zoom, rotation and position
+	const bool isSameFile = (image->absoluteFilePath() == baseImage->absoluteFilePath());
+	if (isSameFile && !image->isPreview() && (baseImage->isPreview() || image->resolutionScale() > displayImageScale)) {
+		baseImage = image;
+		displayImageScale = baseImage->resolutionScale();
+		isPyramidRequested = false;
+		invalidateRenderedImage();
+		showFrame(currentFrameIndex);
+		recalculateCachedPixmap();
+		update();
+		return;
+	}
+
 	invalidateCache();
 	baseImage = image;
 	imageRotation = 0;
+	currentFrameIndex = 0;
+	displayImage = baseImage->frame(currentFrameIndex);
+	displayImageScale = baseImage->resolutionScale();
+	isFullResolutionRequested = false;
+	isPyramidRequested = false;
 	imageOffset = QPoint(0, 0);
 
-	if (baseImage.type() == Image::Type::Vector) {
+	if (baseImage->type() == Image::Type::Vector) {
 		// Create renderer when first used
 		if (svgRenderer == nullptr) {
-			svgRenderer = new QSvgRenderer(baseImage.absoluteFilePath());
+			svgRenderer = new QSvgRenderer(baseImage->absoluteFilePath());
 			svgScaleX = svgRenderer->viewBoxF().width() / svgRenderer->defaultSize().width();
 			svgScaleY = svgRenderer->viewBoxF().height() / svgRenderer->defaultSize().height();
 		}
 	}
 
-	if (baseImage.frameCount() > 1 && baseImage.type() == Image::Type::Movie) {
-		int delay = baseImage.currentFrameDelay();
+	if (baseImage->frameCount() > 1 && baseImage->type() == Image::Type::Movie) {
+		int delay = baseImage->frameDelay(currentFrameIndex);
 		if (delay > 0)
 			animationTimer.start(delay);
 	}
@@ -57,7 +109,8 @@ void ImageViewerWidget::setImage(const Image& image)
 	}
 
 	QSize viewportSize(this->size());
-	if (image.size().width() <= viewportSize.width() && image.size().height() <= viewportSize.height())
+	QSize imageSize(logicalImageSize());
+	if (imageSize.width() <= viewportSize.width() && imageSize.height() <= viewportSize.height())
 		zoom(ZoomOriginalSize);
 	else
 		zoom(ZoomFitToScreen);
@@ -75,7 +128,7 @@ void ImageViewerWidget::zoom(ZoomOperation zoomOperation)
 
 	// Screen fit scale
 	QSize viewportSize(this->size());
-	QSize pixmapSize(baseImage.size());
+	QSize pixmapSize(logicalImageSize());
 	double scale1 = viewportSize.width() / (double)pixmapSize.width();
 	double scale2 = viewportSize.height() / (double)pixmapSize.height();
 	double scaleFit = qMin(scale1, scale2);
@@ -132,8 +185,10 @@ void ImageViewerWidget::zoom(ZoomOperation zoomOperation)
 
 void ImageViewerWidget::rotate(double angle)
 {
-	baseImage.rotate(angle);
-	imageRotation = angle;
+	// Rotation is a view transform, display image stays unrotated and only rendered pixels are transformed
+	imageRotation = std::fmod(imageRotation + angle + 360.0, 360.0);
+	invalidateRenderedImage();
+	recalculateOffsetLimit();
 	//zoom(ZoomFitToScreen);
 	recalculateCachedPixmap();
 	update();
@@ -182,22 +237,31 @@ void ImageViewerWidget::setHightlightedMarker(char channel)
 
 void ImageViewerWidget::nextFrame()
 {
-	if (baseImage.frameCount() == 1)
+	if (baseImage->frameCount() <= 1)
 		return;
 
-	baseImage.jumpToNextImage();
 	animationTimer.stop();
-	recalculateCachedPixmap();
-	update();
+	stepToFrame(currentFrameIndex + 1);
 }
 
 void ImageViewerWidget::previousFrame()
 {
-	if (baseImage.frameCount() == 1)
+	if (baseImage->frameCount() <= 1)
 		return;
 
-	baseImage.jumpToPreviousImage();
 	animationTimer.stop();
+	stepToFrame(currentFrameIndex - 1);
+}
+
+void ImageViewerWidget::stepToFrame(int index)
+{
+	if (!showFrame(index)) {
+		// Frame is decoded in the background meanwhile, it is shown when asked again
+		pendingFrameIndex = index;
+		frameDecodeTimer.start(FrameDecodeRetryDelay);
+		return;
+	}
+	pendingFrameIndex = -1;
 	recalculateCachedPixmap();
 	update();
 }
@@ -210,6 +274,8 @@ void ImageViewerWidget::paintEvent(QPaintEvent* event)
 	QRect centeredRect(QPoint(viewportSize.width() / 2 - imageSize.width() / 2, viewportSize.height() / 2 - imageSize.height() / 2), imageSize);
 
 	centeredRect.translate(preparedImage.renderingOffset);
+	if (isTiledRendering)
+		centeredRect = tiledImageRect.intersected(QRect(QPoint(0, 0), viewportSize));
 
 	bool isMarked = imageMarkerState.value('X', false);
 
@@ -219,16 +285,32 @@ void ImageViewerWidget::paintEvent(QPaintEvent* event)
 	else
 		painter.fillRect(QRect(QPoint(0, 0), viewportSize), QColor("#1e1e1e"));
 
-	if (baseImage.image().isNull()) {
+	if (displayImage.isNull()) {
 		painter.setFont(QFont("Segoe UI", 20));
 		painter.setPen(QColor("#aaa"));
-		if (baseImage.fileName().isEmpty())
+		if (baseImage->fileName().isEmpty())
 			painter.drawText(QRect(QPoint(0, 0), viewportSize), "Loading...", QTextOption(Qt::AlignCenter));
 		else
 			painter.drawText(QRect(QPoint(0, 0), viewportSize), "Unsupported image data format", QTextOption(Qt::AlignCenter));
 	}
 
-	painter.drawImage(centeredRect, preparedImage.image);
+	if (isTiledRendering) {
+		// Tiles missing after eviction are left out until the next recalculation renders them again.
+		// Only tiles in the repainted area are drawn, panning repaints just the exposed strips.
+		const QRect visibleRect = centeredRect.intersected(event->rect()).translated(-tiledImageRect.topLeft());
+		for (int y = visibleRect.top() / TileSize; y <= visibleRect.bottom() / TileSize; y++) {
+			for (int x = visibleRect.left() / TileSize; x <= visibleRect.right() / TileSize; x++) {
+				// Smooth tile is preferred, fast one rendered during interaction fills in where it is missing
+				const QImage* tile = tileCache.object({ imageZoomLevel, x, y, true });
+				if (tile == nullptr)
+					tile = tileCache.object({ imageZoomLevel, x, y, false });
+				if (tile != nullptr)
+					painter.drawImage(tiledImageRect.topLeft() + QPoint(x * TileSize, y * TileSize), *tile);
+			}
+		}
+	} else {
+		painter.drawImage(centeredRect, preparedImage.image);
+	}
 
 	if (showHelpText) {
 		painter.fillRect(QRect(QPoint(0, 0), viewportSize), QColor::fromRgb(30, 30, 30, 210));
@@ -243,8 +325,9 @@ void ImageViewerWidget::paintEvent(QPaintEvent* event)
 		return;
 	}
 
+	descriptionPanelWidth = 0;
 	if (showImageInformation && !isMarked)
-		renderDescription(&painter, baseImage, viewportSize);
+		renderDescription(&painter, *baseImage, viewportSize);
 
 	if (isMarked)
 		painter.fillRect(centeredRect, QBrush(QColor(0, 0, 0, 200), Qt::SolidPattern));
@@ -252,15 +335,17 @@ void ImageViewerWidget::paintEvent(QPaintEvent* event)
 	if (showDebugInfo) {
 		// Print timing info
 		QString debugStr;
-		debugStr.append(QString::number(baseImage.elapsedTimeFileLoad()));
+		debugStr.append(QString::number(baseImage->elapsedTimeFileLoad()));
 		debugStr.append(" ms, ");
-		debugStr.append(QString::number(baseImage.elapsedTimeMetadata()));
+		debugStr.append(QString::number(baseImage->elapsedTimeMetadata()));
 		debugStr.append(" ms, ");
-		debugStr.append(QString::number(baseImage.elapsedTimeBitmapFrames()));
+		debugStr.append(QString::number(baseImage->elapsedTimeBitmapFrames()));
 		debugStr.append(" ms, ");
-		debugStr.append(QString::number(imageTimeRecalculateCache));
+		debugStr.append(QString::number(imageTimeRenderFast));
+		debugStr.append(" / ");
+		debugStr.append(QString::number(imageTimeRenderSmooth));
 		debugStr.append(" ms, ");
-		debugStr.append(QString::number(baseImage.cacheSize()));
+		debugStr.append(QString::number(baseImage->cacheSize() / (1024.0 * 1024.0), 'f', 1));
 		debugStr.append(" MB");
 
 		painter.setFont(QFont("Segoe UI", 12));
@@ -296,6 +381,7 @@ void ImageViewerWidget::paintEvent(QPaintEvent* event)
 
 void ImageViewerWidget::wheelEvent(QWheelEvent* event)
 {
+	beginInteraction(Interaction::Zoom);
 	if (event->angleDelta().y() > 0)
 		zoom(ZoomIn);
 	else if (event->angleDelta().y() < 0)
@@ -305,6 +391,7 @@ void ImageViewerWidget::wheelEvent(QWheelEvent* event)
 void ImageViewerWidget::mouseMoveEvent(QMouseEvent* event)
 {
 	if (isMouseMovementActive) {
+		beginInteraction(Interaction::Drag);
 		mouseOffset = event->pos() - mouseOrigin;
 		//update();
 
@@ -313,16 +400,59 @@ void ImageViewerWidget::mouseMoveEvent(QMouseEvent* event)
 		//recalculateCachedPixmap();
 		//update();
 
+		const bool wasTiledRendering = isTiledRendering;
+		const QPoint previousImagePosition = tiledImageRect.topLeft();
+
 		imageOffset = mouseStartImageOffset - (mouseOffset / imageZoomLevel);
 		recalculateOffsetLimit();
 		recalculateCachedPixmap();
-		update();
+		if (wasTiledRendering && isTiledRendering)
+			scrollImage(tiledImageRect.topLeft() - previousImagePosition);
+		else
+			update();
 		event->accept();
 	} else {
 		event->ignore();
 	}
 }
 
+void ImageViewerWidget::beginInteraction(Interaction type)
+{
+	interaction = type;
+	interactionIdleTimer.start();
+}
+
+void ImageViewerWidget::interactionIdle()
+{
+	// Render full quality once, tiles and prepared image rendered during interaction are replaced
+	interaction = Interaction::None;
+	recalculateCachedPixmap();
+	update();
+}
+
+void ImageViewerWidget::setInteractionIdleTime(int msec)
+{
+	interactionIdleTimer.setInterval(msec);
+}
+
+void ImageViewerWidget::scrollImage(const QPoint& delta)
+{
+	if (delta.isNull())
+		return;
+
+	// Debug info and help text are centered over the image, pixels under them cannot be shifted
+	const QSize viewportSize(this->size());
+	if (showHelpText || showDebugInfo || qAbs(delta.x()) >= viewportSize.width() || qAbs(delta.y()) >= viewportSize.height()) {
+		update();
+		return;
+	}
+
+	// Pixels already on screen are shifted, only exposed strips are repainted. Description panel stays in place.
+	scroll(delta.x(), delta.y(), QRect(descriptionPanelWidth, 0, viewportSize.width() - descriptionPanelWidth, viewportSize.height()));
+	if (descriptionPanelWidth > 0)
+		update(QRect(0, 0, descriptionPanelWidth, viewportSize.height()));
+}
+
 void ImageViewerWidget::mousePressEvent(QMouseEvent* event)
 {
 	if (event->button() == Qt::LeftButton) {
@@ -382,6 +512,7 @@ void ImageViewerWidget::renderDescription(QPainter* painter, const Image& image,
 	}
 	maxWidth = qMax(maxWidth, xOffset + smallMetrics.horizontalAdvance(image.fileName()) + backgroundBuffer);
 	painter->fillRect(QRect(0, 0, maxWidth, viewportSize.height()), QColor::fromRgb(30, 30, 30, 210));
+	descriptionPanelWidth = maxWidth;
 
 	// File index
 	yOffset += largeLineHeight;
@@ -498,18 +629,19 @@ void ImageViewerWidget::renderDescription(QPainter* painter, const Image& image,
 	yOffset += smallLineHeight;
 	painter->setFont(smallFont);
 	painter->setPen(QColor(Qt::white));
-	int megaPixels = int((double(image.size().width() * image.size().height()) / 1e6) + 0.5);
+	const QSize imageSize = logicalImageSize();
+	int megaPixels = int((double(imageSize.width() * imageSize.height()) / 1e6) + 0.5);
 	if (megaPixels > 0)
-		painter->drawText(xOffset, yOffset, QString("%1 x %2 (%3M)").arg(image.size().width()).arg(image.size().height()).arg(megaPixels));
+		painter->drawText(xOffset, yOffset, QString("%1 x %2 (%3M)").arg(imageSize.width()).arg(imageSize.height()).arg(megaPixels));
 	else
-		painter->drawText(xOffset, yOffset, QString("%1 x %2").arg(image.size().width()).arg(image.size().height()));
+		painter->drawText(xOffset, yOffset, QString("%1 x %2").arg(imageSize.width()).arg(imageSize.height()));
 
 	// Current image scale
 	yOffset += smallLineHeight;
 	painter->drawText(xOffset, yOffset, QString("%1 %").arg(imageZoomLevel * 100.0));
 
 	// Animation info
-	if (baseImage.frameCount() > 1) {
+	if (baseImage->frameCount() > 1) {
 		yOffset += separator;
 
 		// Label 'Frames'
@@ -522,7 +654,7 @@ void ImageViewerWidget::renderDescription(QPainter* painter, const Image& image,
 		yOffset += smallLineHeight;
 		painter->setFont(smallFont);
 		painter->setPen(QColor(Qt::white));
-		painter->drawText(xOffset, yOffset, QString("%1 / %2").arg(baseImage.currentFrameIndex() + 1).arg(baseImage.frameCount()));
+		painter->drawText(xOffset, yOffset, QString("%1 / %2").arg(currentFrameIndex + 1).arg(baseImage->frameCount()));
 	}
 
 	// No metadata warning
@@ -559,7 +691,7 @@ void ImageViewerWidget::recalculateOffsetLimit()
 	QSize viewportSize(this->size());
 
 	// Original image size (5472 x 3648)
-	QSize imageSize(baseImage.size());
+	QSize imageSize(logicalImageSize());
 
 	// Size of full image when scaled
 	QSize scaledSize(imageSize * scale);
@@ -580,19 +712,27 @@ void ImageViewerWidget::recalculateCachedPixmap()
 	QElapsedTimer timer;
 	timer.start();
 
-	//QImage baseImageData= baseImage.image();
+	//QImage baseImageData= displayImage;
+
+	requestFullResolutionIfNeeded();
 
 	double scale = imageZoomLevel;
 
+	// Display image may be decoded at reduced resolution, its pixels are scaled less than the logical image
 	Qt::TransformationMode mode = Qt::SmoothTransformation;
-	if (scale >= 1)
+	if (scale / displayImageScale >= 1)
+		mode = Qt::FastTransformation;
+
+	// Frames during drag and wheel zoom use fast path, full quality pass follows when interaction goes idle
+	const bool isFastPreview = (interaction != Interaction::None && mode == Qt::SmoothTransformation);
+	if (isFastPreview)
 		mode = Qt::FastTransformation;
 
 	//Visible target area size (1920 x 1080)
 	QSize viewportSize(this->size());
 
 	// Original image size (5472 x 3648)
-	QSize imageSize(baseImage.size());
+	QSize imageSize(logicalImageSize());
 
 	// Size of full image when scaled
 	QSize scaledSize(imageSize * scale);
@@ -635,6 +775,18 @@ void ImageViewerWidget::recalculateCachedPixmap()
 	QRect limitedSourceAreaRect;
 	limitedSourceAreaRect.setCoords(xp1, yp1, xp2, yp2);
 
+	// Bitmap larger than viewport is rendered in tiles, panning renders only newly exposed tiles
+	isTiledRendering = (baseImage->type() == Image::Type::Bitmap && !displayImage.isNull()
+		&& (scaledSize.width() > viewportSize.width() || scaledSize.height() > viewportSize.height()));
+	if (isTiledRendering) {
+		preparedImage.image = QImage();
+		preparedImage.sourceRect = QRect();
+		backgroundRenderer->cancel();
+		renderTiles(scaledSize, viewportSize);
+		recordRenderTime(isFastPreview, timer.elapsed());
+		return;
+	}
+
 	//// Offset for rendering scaled image at correct position
 	//QPoint renderingOffset(std::abs(oxp1 - xp1), std::abs(oyp1 - yp1));
 	//renderingOffset = renderingOffset / scale;
@@ -649,14 +801,18 @@ void ImageViewerWidget::recalculateCachedPixmap()
 	//preparedImage.renderingOffset = renderingOffset;
 
 	// Test if prepared image data needs to be recalculated
-	bool refreshNeededAnimation = (baseImage.type() == Image::Type::Movie && animationPlayerPreparedFrame != baseImage.currentFrameIndex());
+	bool refreshNeededAnimation = (baseImage->type() == Image::Type::Movie && animationPlayerPreparedFrame != currentFrameIndex);
 	bool refreshNeededSize = (preparedImage.image.size() != targetSize || preparedImage.sourceRect != limitedSourceAreaRect);
-	if (!refreshNeededAnimation && !refreshNeededSize) {
+	bool refreshNeededQuality = (preparedImage.isFastPreview && !isFastPreview);
+	if (!refreshNeededAnimation && !refreshNeededSize && !refreshNeededQuality) {
 		//qDebug() << "Rendering skipped";
 		return;
 	}
 
-	if (baseImage.type() == Image::Type::Vector) {
+	// Prepared image is replaced below, smooth render still running for the previous state is dropped
+	backgroundRenderer->cancel();
+
+	if (baseImage->type() == Image::Type::Vector) {
 		// Alocate image for painting
 		if (preparedImage.image.size() != targetSize)
 			preparedImage.image = QImage(targetSize, QImage::Format_ARGB32_Premultiplied);
@@ -669,39 +825,341 @@ void ImageViewerWidget::recalculateCachedPixmap()
 
 		//qDebug() << "SVG rendered in:" << timer.elapsed() << "ms";
 	}
+	else if (baseImage->type() == Image::Type::Movie) {
+		// Frames are prepared ahead for the current zoom, viewport and rotation, playback only swaps them
+		AnimationFrameCache::RenderState state;
+		if (imageRotation != 0) {
+			state.isRotated = true;
+			state.size = targetSize;
+			state.transform = sourceTransform(displayImageScale) * QTransform::fromTranslate(-limitedSourceAreaRect.x() * scale, -limitedSourceAreaRect.y() * scale);
+			state.format = renderFormat(displayImage);
+			state.isSmooth = (mode == Qt::SmoothTransformation || (!isFastPreview && std::fmod(imageRotation, 90.0) != 0));
+		} else {
+			state.sourceRect = limitedSourceAreaRect;
+			if (displayImageScale < 1.0)
+				state.sourceRect = scaledCoveringRect(limitedSourceAreaRect, displayImageScale);
+			state.size = state.sourceRect.size().scaled(targetSize, Qt::KeepAspectRatio);
+			state.isSmooth = (mode == Qt::SmoothTransformation);
+			state.useKernel = optimize;
+		}
+		animationFrameCache.setRenderState(baseImage, state);
+		AnimationFrameCache::Frame frame = animationFrameCache.frame(currentFrameIndex);
+		if (frame.prepared.isNull())
+			frame = animationFrameCache.render(currentFrameIndex, displayImage, baseImage->frameDelay(currentFrameIndex));
+		preparedImage.image = frame.prepared;
+		preparedImage.sourceRect = limitedSourceAreaRect;
+		animationPlayerPreparedFrame = currentFrameIndex;
+	}
+	else if (imageRotation != 0) {
+		// Only pixels of prepared image are computed, from unrotated display image or its pyramid level
+		const double bitmapScale = scale / displayImageScale;
+		double levelScale = 1.0;
+		QImage source = pyramidSource(bitmapScale, &levelScale);
+		if (source.isNull())
+			source = displayImage;
+		const bool isSmooth = (mode == Qt::SmoothTransformation || (!isFastPreview && std::fmod(imageRotation, 90.0) != 0));
+		const QTransform transform = sourceTransform(displayImageScale * levelScale) * QTransform::fromTranslate(-limitedSourceAreaRect.x() * scale, -limitedSourceAreaRect.y() * scale);
+
+		// Large smooth transform runs in background like unrotated downscale, nearest neighbour result is shown until it is ready
+		const bool isBackgroundRender = (isSmooth && baseImage->type() == Image::Type::Bitmap && qint64(targetSize.width()) * targetSize.height() >= BackgroundRenderMinPixels);
+		preparedImage.image = QImage(targetSize, renderFormat(source));
+		renderTransformed(&preparedImage.image, source, transform, isSmooth && !isBackgroundRender);
+		if (isBackgroundRender)
+			backgroundRenderer->render(source, transform, targetSize, preparedImage.image.format());
+		preparedImage.sourceRect = limitedSourceAreaRect;
+	}
 	else {
-		QImage clipped = baseImage.image().copy(limitedSourceAreaRect);
-
-		int prescaling = 1;
-		if (optimize && mode == Qt::SmoothTransformation) {
-			if (clipped.size().width() >= 8 * targetSize.width() && clipped.size().height() >= 8 * targetSize.height()) {
-				clipped = clipped.scaled(clipped.size() / 4);
-				prescaling = 4;
-			} else if (clipped.size().width() >= 4 * targetSize.width() && clipped.size().height() >= 4 * targetSize.height()) {
-				clipped = clipped.scaled(clipped.size() / 2);
-				prescaling = 2;
-			}
+		QRect displaySourceRect = limitedSourceAreaRect;
+		if (displayImageScale < 1.0)
+			displaySourceRect = scaledCoveringRect(limitedSourceAreaRect, displayImageScale);
+
+		// Zoomed out view is scaled from the nearest larger pyramid level, falling back to display image until it is built
+		double levelScale = 1.0;
+		QImage source = pyramidSource(scale / displayImageScale, &levelScale);
+		if (source.isNull())
+			source = displayImage;
+		else
+			displaySourceRect = scaledCoveringRect(displaySourceRect, levelScale).intersected(source.rect());
+
+		// Visible area is read in place, zoom and resize do not copy it first
+		const QImage clipped = ImageScaler::subImage(source, displaySourceRect);
+
+		// Large smooth downscale runs in background, nearest neighbour result is shown until it is ready.
+		// Own area averaging kernel replaces QImage::scaled for downscaling, optimize toggles it for comparison.
+		const QSize preparedSize = clipped.size().scaled(targetSize, Qt::KeepAspectRatio);
+		if (mode == Qt::SmoothTransformation && baseImage->type() == Image::Type::Bitmap && qint64(clipped.width()) * clipped.height() >= BackgroundRenderMinPixels) {
+			preparedImage.image = clipped.scaled(preparedSize, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+			backgroundRenderer->render(source, displaySourceRect, preparedSize, optimize);
+		} else if (optimize && mode == Qt::SmoothTransformation) {
+			preparedImage.image = ImageScaler::scaled(clipped, preparedSize);
+		} else {
+			preparedImage.image = clipped.scaled(preparedSize, Qt::IgnoreAspectRatio, mode);
 		}
 
-		preparedImage.image = clipped.scaled(targetSize, Qt::KeepAspectRatio, mode);
+		// Area not needing scaling comes back unchanged, view into source pixels must not outlive this function
+		if (clipped.cacheKey() != source.cacheKey() && preparedImage.image.constBits() == clipped.constBits())
+			preparedImage.image = clipped.copy();
+
+		// Painter converts grayscale on every repaint, prepared image is small enough to convert once
+		if (preparedImage.image.format() == QImage::Format_Grayscale8)
+			preparedImage.image.convertTo(QImage::Format_RGB32);
 		//preparedImage.image = originalImage.copy(limitedSourceAreaRect).scaled(targetSize, Qt::KeepAspectRatio, mode);
 		preparedImage.sourceRect = limitedSourceAreaRect;
 
-		//qDebug().nospace() << "Scaled in: " << timer.elapsed() << " ms, Prescaling: " << prescaling << "x";
+		//qDebug().nospace() << "Scaled in: " << timer.elapsed() << " ms, ImageScaler: " << optimize;
 	}
+	preparedImage.isFastPreview = isFastPreview;
 
-	imageTimeRecalculateCache = timer.elapsed();
+	recordRenderTime(isFastPreview, timer.elapsed());
 }
 
-void ImageViewerWidget::invalidateCache()
+void ImageViewerWidget::recordRenderTime(bool isFastPreview, qint64 msec)
+{
+	if (isFastPreview)
+		imageTimeRenderFast = msec;
+	else
+		imageTimeRenderSmooth = msec;
+}
+
+void ImageViewerWidget::renderTiles(const QSize& scaledSize, const QSize& viewportSize)
+{
+	const double scale = imageZoomLevel;
+	const QSize imageSize(logicalImageSize());
+
+	// Position of viewport in scaled image, image smaller than viewport in one direction is centered
+	const QPoint centerPoint(qRound((imageSize.width() / 2 + imageOffset.x()) * scale), qRound((imageSize.height() / 2 + imageOffset.y()) * scale));
+	QPoint viewportOrigin((scaledSize.width() - viewportSize.width()) / 2, (scaledSize.height() - viewportSize.height()) / 2);
+	if (scaledSize.width() > viewportSize.width())
+		viewportOrigin.setX(qBound(0, centerPoint.x() - viewportSize.width() / 2, scaledSize.width() - viewportSize.width()));
+	if (scaledSize.height() > viewportSize.height())
+		viewportOrigin.setY(qBound(0, centerPoint.y() - viewportSize.height() / 2, scaledSize.height() - viewportSize.height()));
+	tiledImageRect = QRect(-viewportOrigin, scaledSize);
+
+	// Tiles share one transformation of the whole source, neighbouring tiles sample the same pixels and join without seams
+	const double bitmapScale = scale / displayImageScale;
+	double levelScale = 1.0;
+	QImage source = pyramidSource(bitmapScale, &levelScale);
+	if (source.isNull())
+		source = displayImage;
+	const double sourceScale = bitmapScale / levelScale;
+	const bool isSmoothNeeded = (sourceScale < 1 || std::fmod(imageRotation, 90.0) != 0);
+	const bool isSmooth = (isSmoothNeeded && interaction == Interaction::None);
+
+	// Smooth tiles are rendered in the background, fast tiles are rendered here and painted until they arrive
+	const BackgroundRenderer::TileFunction renderFastTile = tileRenderer(source, displayImageScale * levelScale, scaledSize, false);
+	QVector<QPoint> smoothTiles;
+
+	const QRect visibleRect = QRect(viewportOrigin, viewportSize).intersected(QRect(QPoint(0, 0), scaledSize));
+	for (int y = visibleRect.top() / TileSize; y <= visibleRect.bottom() / TileSize; y++) {
+		for (int x = visibleRect.left() / TileSize; x <= visibleRect.right() / TileSize; x++) {
+			// Smooth tiles of the same zoom are reused during interaction, fast tiles are rendered only where they are missing
+			if (isSmoothNeeded && tileCache.contains({ scale, x, y, true }))
+				continue;
+			if (isSmooth)
+				smoothTiles.append(QPoint(x, y));
+
+			const TileKey key = { scale, x, y, false };
+			if (tileCache.contains(key))
+				continue;
+			QImage* tile = new QImage(renderFastTile(QPoint(x, y)));
+			tileCache.insert(key, tile, static_cast<int>(tile->sizeInBytes()));
+		}
+	}
+
+	if (!smoothTiles.isEmpty())
+		backgroundRenderer->renderTiles(smoothTiles, tileRenderer(source, displayImageScale * levelScale, scaledSize, true));
+}
+
+BackgroundRenderer::TileFunction ImageViewerWidget::tileRenderer(const QImage& source, double sourceScale, const QSize& scaledSize, bool isSmooth) const
+{
+	// Function owns copies of everything it reads, tiles are rendered on a thread pool thread
+	const QTransform transform = sourceTransform(sourceScale);
+	const QImage::Format format = renderFormat(source);
+	const bool useKernel = (isSmooth && optimize && imageRotation == 0 && scaledSize.width() <= source.width() && scaledSize.height() <= source.height());
+
+	return [source, transform, format, scaledSize, isSmooth, useKernel](const QPoint& tile) {
+		const QRect tileRect = QRect(tile * TileSize, QSize(TileSize, TileSize)).intersected(QRect(QPoint(0, 0), scaledSize));
+
+		// Area averaging kernel renders the same pixels as scaling the whole source, neighbouring tiles join without seams
+		if (useKernel) {
+			QImage image = ImageScaler::scaled(source, scaledSize, tileRect);
+			if (image.format() == QImage::Format_Grayscale8)
+				image.convertTo(QImage::Format_RGB32);
+			return image;
+		}
+
+		// Tiles share one transformation of the whole source, neighbouring tiles sample the same pixels
+		QImage image(tileRect.size(), format);
+		image.fill(Qt::transparent);
+		QPainter painter(&image);
+		painter.setRenderHint(QPainter::SmoothPixmapTransform, isSmooth);
+		painter.setTransform(transform * QTransform::fromTranslate(-tileRect.x(), -tileRect.y()));
+		painter.drawImage(0, 0, source);
+		return image;
+	};
+}
+
+void ImageViewerWidget::backgroundTileRendered(const QPoint& tile, const QImage& image)
+{
+	// Tile requests are made stale by every recalculation, delivered tile belongs to the current zoom
+	QImage* cached = new QImage(image);
+	tileCache.insert({ imageZoomLevel, tile.x(), tile.y(), true }, cached, static_cast<int>(cached->sizeInBytes()));
+	if (isTiledRendering)
+		update(QRect(tiledImageRect.topLeft() + tile * TileSize, image.size()));
+}
+
+QTransform ImageViewerWidget::sourceTransform(double sourceScale) const
+{
+	// Rotation around origin is moved so that bounding box of rotated image starts at origin
+	const QSizeF size(displayImage.width() / displayImageScale, displayImage.height() / displayImageScale);
+	QTransform rotation;
+	rotation.rotate(imageRotation);
+	const QRectF bounds = rotation.mapRect(QRectF(QPointF(0, 0), size));
+
+	return QTransform::fromScale(1 / sourceScale, 1 / sourceScale) * rotation
+		* QTransform::fromTranslate(-bounds.x(), -bounds.y()) * QTransform::fromScale(imageZoomLevel, imageZoomLevel);
+}
+
+void ImageViewerWidget::renderTransformed(QImage* target, const QImage& source, const QTransform& transform, bool isSmooth) const
+{
+	target->fill(Qt::transparent);
+	QPainter painter(target);
+	painter.setRenderHint(QPainter::SmoothPixmapTransform, isSmooth);
+	painter.setTransform(transform);
+	painter.drawImage(0, 0, source);
+}
+
+QImage::Format ImageViewerWidget::renderFormat(const QImage& source) const
+{
+	// Corners of image rotated by other than right angle are transparent
+	if (source.hasAlphaChannel() || std::fmod(imageRotation, 90.0) != 0)
+		return QImage::Format_ARGB32_Premultiplied;
+	return QImage::Format_RGB32;
+}
+
+void ImageViewerWidget::setTileCacheSize(qint64 bytes)
+{
+	tileCache.setMaxCost(static_cast<int>(qMin<qint64>(bytes, std::numeric_limits<int>::max())));
+}
+
+void ImageViewerWidget::invalidateRenderedImage()
 {
 	preparedImage.image = QImage();
 	preparedImage.sourceRect = QRect();
+	tileCache.clear();
+	backgroundRenderer->cancel();
+	animationFrameCache.clear();
+	animationPlayerPreparedFrame = -1;
+}
+
+void ImageViewerWidget::backgroundRendered(const QImage& image)
+{
+	// Smooth result replaces nearest neighbour preview of the same area
+	if (image.size() != preparedImage.image.size())
+		return;
+	preparedImage.image = image;
+	update();
+}
+
+void ImageViewerWidget::invalidateCache()
+{
+	invalidateRenderedImage();
 	if (svgRenderer != nullptr) {
 		delete svgRenderer;
 		svgRenderer = nullptr;
 	}
 	animationTimer.stop();
+	frameDecodeTimer.stop();
+	pendingFrameIndex = -1;
+}
+
+bool ImageViewerWidget::showFrame(int index, int* delay)
+{
+	const int frameCount = baseImage->frameCount();
+	if (frameCount == 0)
+		return false;
+
+	// Frame prepared ahead carries its decoded frame and delay, frame sequence is asked only when prefetch fell behind.
+	// Frames are never decoded here, displayed frame stays until the requested one is decoded in the background.
+	const int frameIndex = (index + frameCount) % frameCount;
+	AnimationFrameCache::Frame frame = animationFrameCache.frame(frameIndex);
+	if (frame.decoded.isNull()) {
+		frame.decoded = baseImage->availableFrame(frameIndex);
+		if (frame.decoded.isNull())
+			return false;
+		frame.delay = baseImage->frameDelay(frameIndex);
+	}
+
+	currentFrameIndex = frameIndex;
+	displayImage = frame.decoded;
+	if (delay != nullptr)
+		*delay = frame.delay;
+	return true;
+}
+
+QImage ImageViewerWidget::rotatedImage(const QImage& image) const
+{
+	if (imageRotation == 0)
+		return image;
+
+	QTransform transform;
+	transform.rotate(imageRotation);
+
+	if (std::fmod(imageRotation, 90.0) == 0)
+		return image.transformed(transform, Qt::FastTransformation);
+	else
+		return image.transformed(transform, Qt::SmoothTransformation);
+}
+
+QSize ImageViewerWidget::logicalImageSize() const
+{
+	QSize size = displayImage.size();
+	if (displayImageScale < 1.0)
+		size = QSize(qRound(displayImage.width() / displayImageScale), qRound(displayImage.height() / displayImageScale));
+	if (imageRotation == 0)
+		return size;
+
+	// Rotated image occupies its bounding box
+	QTransform rotation;
+	rotation.rotate(imageRotation);
+	return rotation.mapRect(QRectF(QPointF(0, 0), QSizeF(size))).size().toSize();
+}
+
+void ImageViewerWidget::requestFullResolutionIfNeeded()
+{
+	// Preview is replaced by decoded image soon, request is decided after that
+	if (isFullResolutionRequested || baseImage->isPreview() || displayImageScale >= 1.0 || imageZoomLevel <= displayImageScale)
+		return;
+
+	isFullResolutionRequested = true;
+	emit fullResolutionRequested(baseImage->absoluteFilePath());
+}
+
+QImage ImageViewerWidget::pyramidSource(double bitmapScale, double* levelScale)
+{
+	// Pyramid is built from first frame, unrotated like display image
+	ImagePyramid* pyramid = baseImage->pyramid();
+	if (pyramid == nullptr || bitmapScale >= 0.5)
+		return QImage();
+
+	QImage level = pyramid->level(bitmapScale, levelScale);
+	if (level.isNull()) {
+		if (!isPyramidRequested && !baseImage->isPreview()) {
+			isPyramidRequested = true;
+			emit pyramidRequested(baseImage);
+		}
+		return QImage();
+	}
+	return level;
+}
+
+void ImageViewerWidget::pyramidBuilt(const ImageHandle& image)
+{
+	if (image != baseImage)
+		return;
+	invalidateRenderedImage();
+	recalculateCachedPixmap();
+	update();
 }
 
 int ImageViewerWidget::findClosestValueIndex(const QVector<double>& values, double x)
@@ -720,8 +1178,11 @@ int ImageViewerWidget::findClosestValueIndex(const QVector<double>& values, doub
 
 void ImageViewerWidget::switchToNextAnimationFrame()
 {
-	baseImage.jumpToNextImage();
-	int delay = baseImage.currentFrameDelay();
+	int delay = -1;
+	if (!showFrame(currentFrameIndex + 1, &delay)) {
+		animationTimer.start(FrameDecodeRetryDelay);
+		return;
+	}
 	if (delay > 0)
 		animationTimer.start(delay);
 
@@ -3,7 +3,12 @@
 #include <QWidget>
 #include <QMap>
 #include <QTimer>
+#include <QCache>
+#include <QHash>
+#include <QTransform>
 #include "Image.h"
+#include "AnimationFrameCache.h"
+#include "BackgroundRenderer.h"
 
 class QSvgRenderer;
 class QMovie;
@@ -25,10 +30,16 @@ public:
 	ImageViewerWidget(QWidget* parent = nullptr);
 	~ImageViewerWidget();
 
-	void setImage(const Image& image);
+	void setImage(const ImageHandle& image);
 	void setImageNumber(int number, int total);
 
-	const Image& currentImage() const { return baseImage; }
+	const ImageHandle& currentImage() const { return baseImage; }
+
+	// Returns currently displayed frame, rotation is applied only when rendering
+	const QImage& currentFrame() const { return displayImage; }
+
+	// Returns image rotated the same way as displayed frame
+	QImage rotatedImage(const QImage& image) const;
 
 	void zoom(ZoomOperation zoomOperation);
 	void rotate(double angle);
@@ -50,6 +61,22 @@ public:
 
 	void setHelpText(const QString& text) { applicationHelpText = text; }
 
+	// Re-render from pyramid levels when they were built for the displayed image
+	void pyramidBuilt(const ImageHandle& image);
+
+	// Set memory budget of rendered tiles in bytes, least recently painted tiles are evicted first
+	void setTileCacheSize(qint64 bytes);
+
+	// Set time without drag or wheel events after which fast preview frames are rendered again at full quality
+	void setInteractionIdleTime(int msec);
+
+signals:
+	// Emitted once per image when zoom needs more detail than the reduced resolution decode provides
+	void fullResolutionRequested(const QString& fileName);
+
+	// Emitted once per image when it is zoomed out enough to be scaled from a pyramid level
+	void pyramidRequested(const ImageHandle& image);
+
 protected:
 	void paintEvent(QPaintEvent* event) override;
 	void wheelEvent(QWheelEvent* event) override;
@@ -59,13 +86,37 @@ protected:
 	void resizeEvent(QResizeEvent* event) override;
 
 private:
+	enum class Interaction
+	{
+		None,
+		Drag,
+		Zoom
+	};
+
+	void beginInteraction(Interaction type);
+	void interactionIdle();
 	void renderDescription(QPainter* painter, const Image& image, const QSize& viewportSize);
+	void scrollImage(const QPoint& delta);
 	void recalculateOffsetLimit();
 	void recalculateCachedPixmap();
+	void recordRenderTime(bool isFastPreview, qint64 msec);
+	void renderTiles(const QSize& scaledSize, const QSize& viewportSize);
+	void invalidateRenderedImage();
+	void backgroundRendered(const QImage& image);
+	void backgroundTileRendered(const QPoint& tile, const QImage& image);
+	BackgroundRenderer::TileFunction tileRenderer(const QImage& source, double sourceScale, const QSize& scaledSize, bool isSmooth) const;
 	void invalidateCache();
 	int findClosestValueIndex(const QVector<double>& values, double x);
+	QSize logicalImageSize() const;
+	void requestFullResolutionIfNeeded();
+	QImage pyramidSource(double bitmapScale, double* levelScale);
+	QTransform sourceTransform(double sourceScale) const;
+	void renderTransformed(QImage* target, const QImage& source, const QTransform& transform, bool isSmooth) const;
+	QImage::Format renderFormat(const QImage& source) const;
 
 	void switchToNextAnimationFrame();
+	bool showFrame(int index, int* delay = nullptr);
+	void stepToFrame(int index);
 
 private:
 	struct PreparedImage
@@ -73,14 +124,49 @@ private:
 		QImage image;
 		QRect sourceRect;
 		QPoint renderingOffset;
+		bool isFastPreview = false;
+	};
+
+	// Tile of scaled image at zoom level, tile coordinates are in units of TileSize
+	struct TileKey
+	{
+		double scale;
+		int x;
+		int y;
+		bool smooth;
+
+		bool operator==(const TileKey& other) const { return scale == other.scale && x == other.x && y == other.y && smooth == other.smooth; }
+		friend uint qHash(const TileKey& key, uint seed = 0) { return qHash(key.scale, seed) ^ uint(key.x) * 31 ^ uint(key.y) * 131071; }
 	};
 
-	Image baseImage;
+	static const int TileSize = 256;
+
+	// Smooth renders of prepared image from this number of pixels run in background
+	static const qint64 BackgroundRenderMinPixels = 2LL * 1000 * 1000;
+
+	// Time after which frame not decoded yet is asked for again, in ms
+	static const int FrameDecodeRetryDelay = 10;
+
+	ImageHandle baseImage;
+	QImage displayImage;
+	double displayImageScale = 1.0; // Size of display image relative to full resolution
+	bool isFullResolutionRequested = false;
+	bool isPyramidRequested = false;
+	int currentFrameIndex;
 	PreparedImage preparedImage;
+	BackgroundRenderer* backgroundRenderer;
+	QCache<TileKey, QImage> tileCache;
+	QRect tiledImageRect; // Scaled image in viewport coordinates
+	bool isTiledRendering = false;
+	Interaction interaction = Interaction::None;
+	QTimer interactionIdleTimer;
 	QSvgRenderer* svgRenderer = nullptr;
 	double svgScaleX;
 	double svgScaleY;
 	QTimer animationTimer;
+	QTimer frameDecodeTimer;
+	int pendingFrameIndex = -1; // Frame stepped to while it was being decoded
+	AnimationFrameCache animationFrameCache;
 	int animationPlayerPreparedFrame = -1;
 
 	double imageZoomLevel;
@@ -93,6 +179,7 @@ private:
 	QPoint mouseOrigin;
 
 	bool showImageInformation;
+	int descriptionPanelWidth = 0; // Width of information panel painted over the left edge of viewport
 	QMap<char, bool> imageMarkerState;
 	char highlightedMarker;
 
@@ -105,5 +192,6 @@ private:
 
 	bool showDebugInfo = false;
 
-	qint64 imageTimeRecalculateCache = 0;
+	qint64 imageTimeRenderFast = 0; // Last render during drag or wheel zoom
+	qint64 imageTimeRenderSmooth = 0; // Last full quality render
 };
@@ -0,0 +1,655 @@
+#include "JpegHandler.h"
+#include <QImage>
+#include <QVariant>
+#include <QScopedPointer>
+#include <QBuffer>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QtConcurrent>
+#include <QDebug>
+#include <cstdio>
+#include <cstdlib>
+#include <csetjmp>
+#include <cstring>
+#include <numeric>
+#include <limits>
+extern "C" {
+#include <jpeglib.h>
+}
+#include "CancellableBuffer.h"
+
+#ifdef _DEBUG
+#pragma comment(lib, "jpegd.lib")
+#else
+#pragma comment(lib, "jpeg.lib")
+#endif
+
+namespace
+{
+	const int SourceBufferSize = 64 * 1024;
+
+	// Smaller images decode fast enough on one thread
+	const qint64 ParallelMinPixels = 32LL * 1000 * 1000;
+
+	QAtomicInt parallelDecoding(1);
+
+	struct ErrorManager
+	{
+		jpeg_error_mgr pub;
+		jmp_buf setjmpBuffer;
+	};
+
+	struct SourceManager
+	{
+		jpeg_source_mgr pub;
+		QIODevice* device = nullptr;
+		bool isDeviceFailed = false;
+		JOCTET buffer[SourceBufferSize];
+	};
+
+	void errorExit(j_common_ptr cinfo)
+	{
+		char message[JMSG_LENGTH_MAX];
+		(*cinfo->err->format_message)(cinfo, message);
+		qWarning() << "JPEG decoding failed:" << message;
+
+		ErrorManager* errorManager = reinterpret_cast<ErrorManager*>(cinfo->err);
+		longjmp(errorManager->setjmpBuffer, 1);
+	}
+
+	void outputMessage(j_common_ptr)
+	{
+		// Corrupt data warnings are ignored, decoder fills missing blocks
+	}
+
+	void initSource(j_decompress_ptr)
+	{}
+
+	boolean fillInputBuffer(j_decompress_ptr cinfo)
+	{
+		SourceManager* source = reinterpret_cast<SourceManager*>(cinfo->src);
+		qint64 count = source->device->read(reinterpret_cast<char*>(source->buffer), SourceBufferSize);
+		if (count <= 0) {
+			// Device was cancelled or data ended prematurely, finish with fake EOI marker
+			source->isDeviceFailed = (count < 0);
+			source->buffer[0] = 0xFF;
+			source->buffer[1] = JPEG_EOI;
+			count = 2;
+		}
+		source->pub.next_input_byte = source->buffer;
+		source->pub.bytes_in_buffer = static_cast<size_t>(count);
+		return TRUE;
+	}
+
+	void skipInputData(j_decompress_ptr cinfo, long count)
+	{
+		if (count <= 0)
+			return;
+
+		SourceManager* source = reinterpret_cast<SourceManager*>(cinfo->src);
+		if (static_cast<size_t>(count) <= source->pub.bytes_in_buffer) {
+			source->pub.next_input_byte += count;
+			source->pub.bytes_in_buffer -= count;
+			return;
+		}
+
+		// Skip rest of the buffer and seek over the remaining data without reading it
+		const qint64 remaining = count - static_cast<long>(source->pub.bytes_in_buffer);
+		source->pub.bytes_in_buffer = 0;
+		if (!source->device->seek(source->device->pos() + remaining))
+			source->device->seek(source->device->size());
+	}
+
+	void termSource(j_decompress_ptr)
+	{}
+
+	// Source reading consecutive memory segments, used to decode stripe of scan data with its own header
+	struct SegmentSource
+	{
+		static const int MaxSegments = 3;
+
+		jpeg_source_mgr pub;
+		const JOCTET* segments[MaxSegments];
+		size_t segmentSizes[MaxSegments];
+		int segmentCount = 0;
+		int nextSegment = 0;
+		JOCTET endMarker[2] = { 0xFF, JPEG_EOI };
+	};
+
+	boolean fillSegmentBuffer(j_decompress_ptr cinfo)
+	{
+		SegmentSource* source = reinterpret_cast<SegmentSource*>(cinfo->src);
+		if (source->nextSegment < source->segmentCount) {
+			source->pub.next_input_byte = source->segments[source->nextSegment];
+			source->pub.bytes_in_buffer = source->segmentSizes[source->nextSegment];
+			source->nextSegment++;
+		} else {
+			source->pub.next_input_byte = source->endMarker;
+			source->pub.bytes_in_buffer = 2;
+		}
+		return TRUE;
+	}
+
+	void skipSegmentData(j_decompress_ptr cinfo, long count)
+	{
+		SegmentSource* source = reinterpret_cast<SegmentSource*>(cinfo->src);
+		while (count > static_cast<long>(source->pub.bytes_in_buffer)) {
+			count -= static_cast<long>(source->pub.bytes_in_buffer);
+			fillSegmentBuffer(cinfo);
+		}
+		if (count > 0) {
+			source->pub.next_input_byte += count;
+			source->pub.bytes_in_buffer -= count;
+		}
+	}
+
+	// Horizontal band of the image starting and ending at restart marker, decodable on its own
+	struct Stripe
+	{
+		int firstMcuRow = 0;
+		int mcuRowCount = 0;
+		int dataBegin = 0;
+		int dataEnd = 0;
+		bool isDecoded = false;
+	};
+
+	struct ScanLayout
+	{
+		QByteArray data;
+		QByteArray header;      // Header without APPn and COM segments, image height is patched for each stripe
+		int heightOffset = -1;  // Offset of image height in SOF segment of header
+		int scanOffset = 0;     // Offset of entropy coded data in file
+		int width = 0;
+		int height = 0;
+		int mcuHeight = 8;
+		int mcusPerRow = 0;
+		int mcuRows = 0;
+		int restartInterval = 0;
+		int denominator = 1;
+		J_COLOR_SPACE colorSpace = JCS_EXT_BGRA;
+	};
+
+	// Copy header segments needed for decoding, returns false for unsupported layout
+	bool copyStripeHeader(ScanLayout* layout)
+	{
+		const uchar* data = reinterpret_cast<const uchar*>(layout->data.constData());
+		if (layout->scanOffset < 4 || data[0] != 0xFF || data[1] != 0xD8)
+			return false;
+		layout->header = QByteArray("\xFF\xD8", 2);
+
+		int pos = 2;
+		while (pos + 4 <= layout->scanOffset) {
+			if (data[pos] != 0xFF)
+				return false;
+			const uchar marker = data[pos + 1];
+			if (marker == 0xFF) {
+				pos++;
+				continue;
+			}
+
+			const int length = (data[pos + 2] << 8) | data[pos + 3];
+			const bool isAppSegment = (marker >= 0xE0 && marker <= 0xEF) || marker == 0xFE;
+			if (!isAppSegment) {
+				// Baseline and extended sequential Huffman only
+				if (marker == 0xC0 || marker == 0xC1)
+					layout->heightOffset = layout->header.size() + 5;
+				layout->header.append(reinterpret_cast<const char*>(data + pos), length + 2);
+			}
+			pos += length + 2;
+		}
+		return layout->heightOffset > 0 && pos == layout->scanOffset;
+	}
+
+	// Split scan data at restart markers. Stripes start at MCU row and at restart interval with RST0 so that
+	// data of every stripe is contiguous and needs no renumbering of markers.
+	QVector<Stripe> findStripes(const ScanLayout& layout, int preferredCount)
+	{
+		const qint64 intervalMcus = layout.restartInterval;
+		const qint64 unitMcus = std::lcm(qint64(layout.mcusPerRow), 8 * intervalMcus);
+		const int unitRows = static_cast<int>(unitMcus / layout.mcusPerRow);
+		const int unitCount = (layout.mcuRows + unitRows - 1) / unitRows;
+		if (unitCount < 2)
+			return QVector<Stripe>();
+
+		const int unitsPerStripe = qMax(1, (unitCount + preferredCount - 1) / preferredCount);
+		const int stripeRows = unitsPerStripe * unitRows;
+		const qint64 intervalsPerStripe = unitsPerStripe * unitMcus / intervalMcus;
+
+		QVector<Stripe> stripes;
+		Stripe stripe;
+		stripe.dataBegin = layout.scanOffset;
+
+		const uchar* base = reinterpret_cast<const uchar*>(layout.data.constData());
+		const uchar* end = base + layout.data.size();
+		const uchar* p = base + layout.scanOffset;
+		qint64 intervalIndex = 0;
+		bool hasEndMarker = false;
+		while (p + 1 < end && (p = static_cast<const uchar*>(memchr(p, 0xFF, end - p - 1))) != nullptr) {
+			const uchar marker = p[1];
+			if (marker == 0x00 || marker == 0xFF) {
+				p += (marker == 0x00) ? 2 : 1;
+				continue;
+			}
+			if (marker >= 0xD0 && marker <= 0xD7) {
+				intervalIndex++;
+				if (intervalIndex % intervalsPerStripe == 0) {
+					stripe.dataEnd = static_cast<int>(p - base);
+					stripes.append(stripe);
+					stripe.dataBegin = static_cast<int>(p + 2 - base);
+				}
+				p += 2;
+				continue;
+			}
+			if (marker == 0xD9)
+				hasEndMarker = true;
+			else
+				return QVector<Stripe>(); // Marker inside of scan data (e.g. DNL), not supported
+			break;
+		}
+		stripe.dataEnd = hasEndMarker ? static_cast<int>(p - base) : layout.data.size();
+		stripes.append(stripe);
+
+		// Missing or extra restart markers, layout of stripes cannot be trusted
+		if (stripes.count() != (layout.mcuRows + stripeRows - 1) / stripeRows)
+			return QVector<Stripe>();
+
+		for (int i = 0; i < stripes.count(); i++) {
+			stripes[i].firstMcuRow = i * stripeRows;
+			stripes[i].mcuRowCount = qMin(stripeRows, layout.mcuRows - i * stripeRows);
+		}
+		return stripes;
+	}
+
+	bool decodeStripe(const ScanLayout& layout, const Stripe& stripe, uchar* bits, qsizetype bytesPerLine, int outputHeight, const std::function<bool()>& isCancelled)
+	{
+		// Header of the stripe describes image only as high as the stripe
+		QByteArray header = layout.header;
+		const int stripeHeight = qMin(layout.height, (stripe.firstMcuRow + stripe.mcuRowCount) * layout.mcuHeight) - stripe.firstMcuRow * layout.mcuHeight;
+		header[layout.heightOffset] = char(stripeHeight >> 8);
+		header[layout.heightOffset + 1] = char(stripeHeight & 0xFF);
+
+		SegmentSource source;
+		source.segments[0] = reinterpret_cast<const JOCTET*>(header.constData());
+		source.segmentSizes[0] = header.size();
+		source.segments[1] = reinterpret_cast<const JOCTET*>(layout.data.constData()) + stripe.dataBegin;
+		source.segmentSizes[1] = stripe.dataEnd - stripe.dataBegin;
+		source.segments[2] = source.endMarker;
+		source.segmentSizes[2] = 2;
+		source.segmentCount = 3;
+		source.pub.init_source = initSource;
+		source.pub.fill_input_buffer = fillSegmentBuffer;
+		source.pub.skip_input_data = skipSegmentData;
+		source.pub.resync_to_restart = jpeg_resync_to_restart;
+		source.pub.term_source = termSource;
+		source.pub.next_input_byte = nullptr;
+		source.pub.bytes_in_buffer = 0;
+
+		jpeg_decompress_struct cinfo;
+		ErrorManager errorManager;
+		cinfo.err = jpeg_std_error(&errorManager.pub);
+		errorManager.pub.error_exit = errorExit;
+		errorManager.pub.output_message = outputMessage;
+
+		if (setjmp(errorManager.setjmpBuffer)) {
+			jpeg_destroy_decompress(&cinfo);
+			return false;
+		}
+
+		jpeg_create_decompress(&cinfo);
+		cinfo.src = &source.pub;
+		jpeg_read_header(&cinfo, TRUE);
+		cinfo.out_color_space = layout.colorSpace;
+		cinfo.scale_num = 1;
+		cinfo.scale_denom = layout.denominator;
+		// Fancy upsampling filters subsampled chroma across neighbouring rows, stripe does not see the rows beyond its edges.
+		// Chroma is replicated instead, only images decoded in stripes differ slightly from serial decode.
+		cinfo.do_fancy_upsampling = FALSE;
+		jpeg_start_decompress(&cinfo);
+
+		const int firstLine = stripe.firstMcuRow * layout.mcuHeight / layout.denominator;
+		if (firstLine + int(cinfo.output_height) > outputHeight) {
+			jpeg_destroy_decompress(&cinfo);
+			return false;
+		}
+
+		while (cinfo.output_scanline < cinfo.output_height) {
+			if (cinfo.output_scanline % 16 == 0 && isCancelled()) {
+				jpeg_destroy_decompress(&cinfo);
+				return false;
+			}
+			JSAMPROW row = bits + (firstLine + cinfo.output_scanline) * bytesPerLine;
+			jpeg_read_scanlines(&cinfo, &row, 1);
+		}
+
+		jpeg_finish_decompress(&cinfo);
+		jpeg_destroy_decompress(&cinfo);
+		return true;
+	}
+
+	quint32 readExifValue(const uchar* data, int size, bool isBigEndian)
+	{
+		quint32 value = 0;
+		for (int i = 0; i < size; i++) {
+			if (isBigEndian)
+				value = (value << 8) | data[i];
+			else
+				value |= quint32(data[i]) << (8 * i);
+		}
+		return value;
+	}
+
+	// Returns transformation from orientation tag in EXIF APP1 marker
+	QImageIOHandler::Transformations exifTransformation(jpeg_saved_marker_ptr marker)
+	{
+		for (; marker != nullptr; marker = marker->next) {
+			if (marker->marker != JPEG_APP0 + 1 || marker->data_length < 14 || memcmp(marker->data, "Exif\0\0", 6) != 0)
+				continue;
+
+			const uchar* tiff = marker->data + 6;
+			const quint32 tiffSize = marker->data_length - 6;
+			const bool isBigEndian = (tiff[0] == 'M');
+			const quint32 ifdOffset = readExifValue(tiff + 4, 4, isBigEndian);
+			// Offsets come from the file, compared without overflow
+			if (ifdOffset > tiffSize - 2)
+				return QImageIOHandler::TransformationNone;
+
+			const quint32 entryCount = readExifValue(tiff + ifdOffset, 2, isBigEndian);
+			for (quint32 i = 0; i < entryCount; i++) {
+				const quint64 entryOffset = quint64(ifdOffset) + 2 + quint64(i) * 12;
+				if (entryOffset + 12 > tiffSize)
+					break;
+				if (readExifValue(tiff + entryOffset, 2, isBigEndian) != 0x0112)
+					continue;
+
+				return JpegHandler::exifOrientationTransformation(readExifValue(tiff + entryOffset + 8, 2, isBigEndian));
+			}
+		}
+		return QImageIOHandler::TransformationNone;
+	}
+}
+
+JpegHandler::JpegHandler()
+{}
+
+JpegHandler::~JpegHandler()
+{}
+
+bool JpegHandler::canRead() const
+{
+	if (!canRead(device()))
+		return false;
+
+	setFormat("jpeg");
+	return true;
+}
+
+bool JpegHandler::canRead(QIODevice* device)
+{
+	if (device == nullptr)
+		return false;
+
+	uchar header[3];
+	if (device->peek(reinterpret_cast<char*>(header), 3) != 3)
+		return false;
+	return header[0] == 0xFF && header[1] == 0xD8 && header[2] == 0xFF;
+}
+
+QImageIOHandler::Transformations JpegHandler::exifOrientationTransformation(int orientation)
+{
+	switch (orientation) {
+		case 2: return QImageIOHandler::TransformationMirror;
+		case 3: return QImageIOHandler::TransformationRotate180;
+		case 4: return QImageIOHandler::TransformationFlip;
+		case 5: return QImageIOHandler::TransformationFlipAndRotate90;
+		case 6: return QImageIOHandler::TransformationRotate90;
+		case 7: return QImageIOHandler::TransformationMirrorAndRotate90;
+		case 8: return QImageIOHandler::TransformationRotate270;
+		default: return QImageIOHandler::TransformationNone;
+	}
+}
+
+int JpegHandler::scaleDenominator(const QSize& fullSize, const QSize& targetSize)
+{
+	if (!targetSize.isValid() || fullSize.isEmpty())
+		return 1;
+
+	// Compare long and short sides, EXIF rotation is applied only after decoding
+	const double longScale = double(qMax(targetSize.width(), targetSize.height())) / qMax(fullSize.width(), fullSize.height());
+	const double shortScale = double(qMin(targetSize.width(), targetSize.height())) / qMin(fullSize.width(), fullSize.height());
+	const double fitScale = qMin(longScale, shortScale);
+
+	int denominator = 1;
+	while (denominator < 8 && 1.0 / (denominator * 2) >= fitScale)
+		denominator *= 2;
+	return denominator;
+}
+
+void JpegHandler::setParallelDecoding(bool enabled)
+{
+	parallelDecoding.storeRelaxed(enabled ? 1 : 0);
+}
+
+bool JpegHandler::isParallelDecoding()
+{
+	return parallelDecoding.loadRelaxed() != 0;
+}
+
+void JpegHandler::benchmark(const QStringList& fileNames, QTextStream& out)
+{
+	static const int Runs = 3;
+	const bool wasParallel = isParallelDecoding();
+
+	for (const QString& fileName : fileNames) {
+		QFile file(fileName);
+		if (!file.open(QFile::ReadOnly)) {
+			out << "Benchmark cannot read: " << fileName << Qt::endl;
+			continue;
+		}
+		const QByteArray data = file.readAll();
+
+		QImage images[2];
+		qint64 times[2] = { std::numeric_limits<qint64>::max(), std::numeric_limits<qint64>::max() };
+		for (int mode = 0; mode < 2; mode++) {
+			setParallelDecoding(mode == 1);
+			for (int run = 0; run < Runs; run++) {
+				QBuffer buffer;
+				buffer.setData(data);
+				buffer.open(QIODevice::ReadOnly);
+				JpegHandler handler;
+				handler.setDevice(&buffer);
+
+				QElapsedTimer timer;
+				timer.start();
+				if (!handler.read(&images[mode]))
+					break;
+				times[mode] = qMin(times[mode], timer.elapsed());
+			}
+		}
+
+		if (images[0].isNull() || images[1].isNull()) {
+			out << "Benchmark cannot decode: " << fileName << Qt::endl;
+			continue;
+		}
+		if (images[0].size() != images[1].size() || images[0].format() != images[1].format()) {
+			out << "Benchmark: serial and parallel decode differ in size or format: " << fileName << Qt::endl;
+			continue;
+		}
+
+		// Stripes replicate chroma where serial decode upsamples it smoothly, report how far their pixels are apart
+		const int rowBytes = images[0].width() * images[0].depth() / 8;
+		int maxDifference = 0;
+		qint64 sumDifference = 0;
+		for (int y = 0; y < images[0].height(); y++) {
+			const uchar* serialLine = images[0].constScanLine(y);
+			const uchar* parallelLine = images[1].constScanLine(y);
+			for (int x = 0; x < rowBytes; x++) {
+				const int difference = std::abs(serialLine[x] - parallelLine[x]);
+				maxDifference = qMax(maxDifference, difference);
+				sumDifference += difference;
+			}
+		}
+		const double meanDifference = double(sumDifference) / (qint64(rowBytes) * images[0].height());
+
+		out << "Benchmark: " << fileName << " " << images[0].width() << "x" << images[0].height() << ": serial " << times[0] << " ms, parallel "
+			<< times[1] << " ms, max difference: " << maxDifference << ", mean difference: " << meanDifference << Qt::endl;
+	}
+	setParallelDecoding(wasParallel);
+}
+
+bool JpegHandler::read(QImage* image)
+{
+	QElapsedTimer timer;
+	timer.start();
+
+	QScopedPointer<SourceManager> source(new SourceManager());
+	source->device = device();
+	source->pub.init_source = initSource;
+	source->pub.fill_input_buffer = fillInputBuffer;
+	source->pub.skip_input_data = skipInputData;
+	source->pub.resync_to_restart = jpeg_resync_to_restart;
+	source->pub.term_source = termSource;
+	source->pub.next_input_byte = nullptr;
+	source->pub.bytes_in_buffer = 0;
+
+	jpeg_decompress_struct cinfo;
+	ErrorManager errorManager;
+	cinfo.err = jpeg_std_error(&errorManager.pub);
+	errorManager.pub.error_exit = errorExit;
+	errorManager.pub.output_message = outputMessage;
+
+	if (setjmp(errorManager.setjmpBuffer)) {
+		jpeg_destroy_decompress(&cinfo);
+		*image = QImage();
+		return false;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	cinfo.src = &source->pub;
+	jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xFFFF);
+	jpeg_read_header(&cinfo, TRUE);
+
+	jpegFullSize = QSize(cinfo.image_width, cinfo.image_height);
+	jpegTransformation = exifTransformation(cinfo.marker_list);
+
+	// CMYK needs inversion and color management, leave it to Qt decoder
+	if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+
+	const int denominator = scaleDenominator(jpegFullSize, jpegScaledSize);
+
+	// JPEG has no alpha, BGRA output has alpha 0xFF and is valid RGB32. Grayscale is kept at one byte per pixel.
+	const bool isGrayscale = (cinfo.jpeg_color_space == JCS_GRAYSCALE);
+	const J_COLOR_SPACE outColorSpace = isGrayscale ? JCS_GRAYSCALE : JCS_EXT_BGRA;
+	const QImage::Format outFormat = isGrayscale ? QImage::Format_Grayscale8 : QImage::Format_RGB32;
+
+	// Scan data of large sequential JPEG with restart markers can be split into stripes decoded in parallel
+	QBuffer* buffer = qobject_cast<QBuffer*>(device());
+	const qint64 outputPixels = qint64(cinfo.image_width / denominator) * (cinfo.image_height / denominator);
+	const bool isSplittable = (!cinfo.progressive_mode && cinfo.restart_interval > 0 && cinfo.comps_in_scan == cinfo.num_components
+		&& outputPixels >= ParallelMinPixels);
+
+	if (isParallelDecoding() && buffer != nullptr && isSplittable) {
+		ScanLayout layout;
+		layout.data = buffer->data();
+		layout.scanOffset = static_cast<int>(buffer->pos() - source->pub.bytes_in_buffer);
+		layout.width = cinfo.image_width;
+		layout.height = cinfo.image_height;
+		layout.restartInterval = cinfo.restart_interval;
+		layout.denominator = denominator;
+		layout.colorSpace = outColorSpace;
+
+		// Single component scans are not interleaved, MCU is one 8x8 block
+		const int mcuWidth = (cinfo.comps_in_scan == 1) ? DCTSIZE : cinfo.max_h_samp_factor * DCTSIZE;
+		layout.mcuHeight = (cinfo.comps_in_scan == 1) ? DCTSIZE : cinfo.max_v_samp_factor * DCTSIZE;
+		layout.mcusPerRow = (layout.width + mcuWidth - 1) / mcuWidth;
+		layout.mcuRows = (layout.height + layout.mcuHeight - 1) / layout.mcuHeight;
+
+		// Layout not suitable for splitting continues with serial decoding below
+		QVector<Stripe> stripes;
+		if (copyStripeHeader(&layout))
+			stripes = findStripes(layout, QThreadPool::globalInstance()->maxThreadCount() * 2);
+
+		if (!stripes.isEmpty()) {
+			jpeg_destroy_decompress(&cinfo);
+
+			*image = QImage((layout.width + denominator - 1) / denominator, (layout.height + denominator - 1) / denominator, outFormat);
+			if (image->isNull())
+				return false;
+
+			// Stripes write to distinct lines of the image, bits are taken once so that threads do not detach it
+			CancellableBuffer* cancellableBuffer = dynamic_cast<CancellableBuffer*>(buffer);
+			std::function<bool()> isCancelled = [cancellableBuffer]() { return cancellableBuffer != nullptr && cancellableBuffer->isCancelled(); };
+			uchar* bits = image->bits();
+			const qsizetype bytesPerLine = image->bytesPerLine();
+			const int outputHeight = image->height();
+			QtConcurrent::blockingMap(stripes, [&](Stripe& stripe) {
+				if (!isCancelled())
+					stripe.isDecoded = decodeStripe(layout, stripe, bits, bytesPerLine, outputHeight, isCancelled);
+			});
+
+			for (const Stripe& stripe : stripes) {
+				if (!stripe.isDecoded) {
+					*image = QImage();
+					return false;
+				}
+			}
+			qDebug() << "JPEG decoded in:" << timer.elapsed() << "ms, stripes:" << stripes.count() << image->size();
+			return true;
+		}
+	}
+
+	cinfo.out_color_space = outColorSpace;
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = denominator;
+	jpeg_start_decompress(&cinfo);
+
+	*image = QImage(cinfo.output_width, cinfo.output_height, outFormat);
+	if (image->isNull()) {
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+
+	while (cinfo.output_scanline < cinfo.output_height) {
+		JSAMPROW row = image->scanLine(cinfo.output_scanline);
+		jpeg_read_scanlines(&cinfo, &row, 1);
+		if (source->isDeviceFailed) {
+			jpeg_destroy_decompress(&cinfo);
+			*image = QImage();
+			return false;
+		}
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	qDebug() << "JPEG decoded in:" << timer.elapsed() << "ms, stripes:" << 1 << image->size();
+	return true;
+}
+
+QVariant JpegHandler::option(ImageOption option) const
+{
+	switch (option) {
+		case Size:
+			return jpegFullSize;
+		case ScaledSize:
+			return jpegScaledSize;
+		case ImageTransformation:
+			return int(jpegTransformation);
+		default:
+			return QVariant();
+	}
+}
+
+void JpegHandler::setOption(ImageOption option, const QVariant& value)
+{
+	if (option == ScaledSize)
+		jpegScaledSize = value.toSize();
+}
+
+bool JpegHandler::supportsOption(ImageOption option) const
+{
+	return option == Size || option == ScaledSize || option == ImageTransformation;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <QImageIOHandler>
+#include <QSize>
+#include <QStringList>
+#include <QTextStream>
+
+// Decodes JPEG with libjpeg-turbo straight into RGB32 (or Grayscale8) image buffer.
+// ScaledSize option is the minimum size needed for display, the decoder picks the smallest DCT scale (1/2, 1/4 or 1/8)
+// which still covers it. Size and ImageTransformation options are valid after read.
+class JpegHandler : public QImageIOHandler
+{
+public:
+	JpegHandler();
+	~JpegHandler();
+
+	bool canRead() const override;
+	bool read(QImage* image) override;
+	int imageCount() const override { return 1; }
+
+	QVariant option(ImageOption option) const override;
+	void setOption(ImageOption option, const QVariant& value) override;
+	bool supportsOption(ImageOption option) const override;
+
+	static bool canRead(QIODevice* device);
+
+	// Returns transformation for EXIF orientation tag value
+	static QImageIOHandler::Transformations exifOrientationTransformation(int orientation);
+
+	// Returns denominator of DCT scaling for image of full size displayed in target size
+	static int scaleDenominator(const QSize& fullSize, const QSize& targetSize);
+
+	// Large JPEGs with restart markers are split at restart intervals and decoded by several threads, enabled by default
+	static void setParallelDecoding(bool enabled);
+	static bool isParallelDecoding();
+
+	// Print best of several serial and parallel decode times of each file to out, and how far results differ
+	static void benchmark(const QStringList& fileNames, QTextStream& out);
+
+private:
+	QSize jpegFullSize;
+	QSize jpegScaledSize;
+	QImageIOHandler::Transformations jpegTransformation = QImageIOHandler::TransformationNone;
+};
@@ -13,7 +13,7 @@ MetadataReader::MetadataReader()
 MetadataReader::~MetadataReader()
 {}
 
-MetadataCollection MetadataReader::load(const QByteArray& fileData, const QString& fileType)
+MetadataCollection MetadataReader::load(const QByteArray& fileData, const QString& fileType, EmbeddedPreview* preview)
 {
 	// Catch unsupported file extensions
 	if (fileType == "ico" || fileType == "svg" || fileType == "tga")
@@ -28,6 +28,24 @@ MetadataCollection MetadataReader::load(const QByteArray& fileData, const QStrin
 
 		image->readMetadata();
 
+		// Main image size is checked before any preview data is copied, smaller images decode fast enough
+		if (preview != nullptr) {
+			preview->imageSize = QSize(image->pixelWidth(), image->pixelHeight());
+			Exiv2::ExifData::const_iterator orientationItem = image->exifData().findKey(Exiv2::ExifKey("Exif.Image.Orientation"));
+			if (orientationItem != image->exifData().end())
+				preview->orientation = static_cast<int>(orientationItem->toUint32());
+
+			if (qint64(preview->imageSize.width()) * preview->imageSize.height() >= preview->minPixels) {
+				// Previews are sorted by size, last one is the largest
+				Exiv2::PreviewManager previewManager(*image);
+				Exiv2::PreviewPropertiesList previews = previewManager.getPreviewProperties();
+				if (!previews.empty()) {
+					Exiv2::PreviewImage previewImage = previewManager.getPreviewImage(previews.back());
+					preview->data = QByteArray(reinterpret_cast<const char*>(previewImage.pData()), static_cast<int>(previewImage.size()));
+				}
+			}
+		}
+
 		Exiv2::ExifData& exifData = image->exifData();
 		Exiv2::ExifData::const_iterator exifEnd = exifData.end();
 		for (Exiv2::ExifData::const_iterator i = exifData.begin(); i != exifEnd; ++i) {
@@ -2,16 +2,27 @@
 
 #include <QString>
 #include <QVector>
+#include <QImage>
 #include "MetadataItem.h"
 #include "MetadataCollection.h"
 
+// Largest embedded preview of image, read together with metadata
+struct EmbeddedPreview
+{
+	qint64 minPixels = 0; // Preview is extracted only when main image has at least this many pixels
+	QSize imageSize; // Size of the main image
+	int orientation = 1; // EXIF orientation, applies to both images
+	QByteArray data; // Encoded preview, empty when there is none or main image is too small
+};
+
 class MetadataReader
 {
 public:
 	MetadataReader();
 	~MetadataReader();
 
-	static MetadataCollection load(const QByteArray& fileData, const QString& fileType);
+	// Read metadata of file. When preview is given, largest embedded preview is taken from the same parse.
+	static MetadataCollection load(const QByteArray& fileData, const QString& fileType, EmbeddedPreview* preview = nullptr);
 
 private:
 	static QString decodeExposureProgram(int code);
@@ -7,6 +7,7 @@
 #include <QFileInfo>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <QScreen>
 #include <QDebug>
 #include "ImageProcessor.h"
 #include "Image.h"
@@ -25,8 +26,33 @@ PhotoManagerWindow::PhotoManagerWindow(const QStringList& files, QWidget* parent
 
 	ui.centralWidget->setLayout(layout);
 
+	QString settingsPath(qApp->applicationFilePath());
+	settingsPath = QFileInfo(settingsPath).absoluteDir().absoluteFilePath("PhotoManager.json");
+
+	settings.load(settingsPath);
+	settings.initializeValue("window.fullscreen", true);
+	settings.initializeValue("window.maximized", true);
+	settings.initializeValue("cache.size", 1024); // MB
+	settings.initializeValue("cache.fileDataSize", 2048); // MB
+	settings.initializeValue("jpeg.parallelDecoding", true);
+	settings.initializeValue("viewer.tileCacheSize", 128); // MB
+	settings.initializeValue("viewer.interactionIdleTime", 150); // ms
+	imageViewer->setTileCacheSize(settings.value("viewer.tileCacheSize").toLongLong() * 1024 * 1024);
+	imageViewer->setInteractionIdleTime(settings.value("viewer.interactionIdleTime").toInt());
+
 	imageProcessor = new ImageProcessor(this);
+	imageProcessor->setCacheSize(settings.value("cache.size").toLongLong() * 1024 * 1024, settings.value("cache.fileDataSize").toLongLong() * 1024 * 1024);
+	imageProcessor->setParallelJpegDecoding(settings.value("jpeg.parallelDecoding").toBool());
 	connect(imageProcessor, &ImageProcessor::imageLoaded, this, &PhotoManagerWindow::imageLoaded);
+	connect(imageViewer, &ImageViewerWidget::fullResolutionRequested, imageProcessor, &ImageProcessor::loadFullImage);
+	connect(imageViewer, &ImageViewerWidget::pyramidRequested, imageProcessor, &ImageProcessor::buildPyramid);
+	connect(imageProcessor, &ImageProcessor::pyramidBuilt, imageViewer, &ImageViewerWidget::pyramidBuilt);
+
+	// Images fitted to the largest screen do not need full resolution until zoomed in
+	QSize screenSize;
+	for (const QScreen* screen : QGuiApplication::screens())
+		screenSize = screenSize.expandedTo(screen->size());
+	imageProcessor->setTargetSize(screenSize);
 
 	QString fileName;
 	if (!files.isEmpty()) {
@@ -45,15 +71,13 @@ PhotoManagerWindow::PhotoManagerWindow(const QStringList& files, QWidget* parent
 	fileList->setCurrentFile(fileInfo.absoluteFilePath());
 
 	imageProcessor->loadImage(fileList->fileAtOffset(0).fullFilePath);
-	imageProcessor->preloadImage(fileList->fileAtOffset(1).fullFilePath);
-	imageProcessor->preloadImage(fileList->fileAtOffset(-1).fullFilePath);
+	preloadNeighbours(0);
 
-	QString settingsPath(qApp->applicationFilePath());
-	settingsPath = QFileInfo(settingsPath).absoluteDir().absoluteFilePath("PhotoManager.json");
+	// Widen preload window when user stops navigating
+	connect(&prefetchIdleTimer, &QTimer::timeout, this, [this]() { preloadNeighbours(0); });
+	prefetchIdleTimer.setSingleShot(true);
+	prefetchIdleTimer.setInterval(1500);
 
-	settings.load(settingsPath);
-	settings.initializeValue("window.fullscreen", true);
-	settings.initializeValue("window.maximized", true);
 
 	Qt::WindowStates windowStates = Qt::WindowActive;
 	if (settings.value("window.fullscreen").toBool())
@@ -195,9 +219,9 @@ void PhotoManagerWindow::changeEvent(QEvent* event)
 	}
 }
 
-void PhotoManagerWindow::imageLoaded(const Image& image)
+void PhotoManagerWindow::imageLoaded(const ImageHandle& image)
 {
-	fileList->setCurrentFile(image.absoluteFilePath());
+	fileList->setCurrentFile(image->absoluteFilePath());
 	const ImageFileList::Item& item = fileList->fileAtOffset(0);
 
 	imageViewer->setImage(image);
@@ -207,18 +231,32 @@ void PhotoManagerWindow::imageLoaded(const Image& image)
 
 void PhotoManagerWindow::nextFile(int multiplier)
 {
-	int offset = 1 * multiplier;
-	imageProcessor->loadImage(fileList->fileAtOffset(offset).fullFilePath);
-	imageProcessor->preloadImage(fileList->fileAtOffset(offset + 1).fullFilePath);
-	imageProcessor->preloadImage(fileList->fileAtOffset(offset + 2).fullFilePath);
+	navigateToOffset(1 * multiplier);
 }
 
 void PhotoManagerWindow::previousFile(int multiplier)
 {
-	int offset = -1 * multiplier;
-	imageProcessor->loadImage(fileList->fileAtOffset(offset).fullFilePath);
-	imageProcessor->preloadImage(fileList->fileAtOffset(offset - 1).fullFilePath);
-	imageProcessor->preloadImage(fileList->fileAtOffset(offset - 2).fullFilePath);
+	navigateToOffset(-1 * multiplier);
+}
+
+void PhotoManagerWindow::navigateToOffset(int offset)
+{
+	prefetchPlanner.recordNavigation(offset);
+	// Image from cache is displayed immediately, current file is then already moved by the offset
+	bool isDisplayed = imageProcessor->loadImage(fileList->fileAtOffset(offset).fullFilePath);
+	preloadNeighbours(isDisplayed ? 0 : offset);
+	prefetchIdleTimer.start();
+}
+
+void PhotoManagerWindow::preloadNeighbours(int offset)
+{
+	PrefetchPlanner::Plan plan = prefetchPlanner.plan(imageProcessor->cacheCapacity());
+
+	// Images in direction of travel follow the navigation step (e.g. Shift + Arrow skips 10), images behind are direct neighbours
+	for (int i = 1; i <= plan.aheadCount; i++)
+		imageProcessor->preloadImage(fileList->fileAtOffset(offset + plan.direction * plan.stepSize * i).fullFilePath, i);
+	for (int i = 1; i <= plan.behindCount; i++)
+		imageProcessor->preloadImage(fileList->fileAtOffset(offset - plan.direction * i).fullFilePath, 2 * i);
 }
 
 void PhotoManagerWindow::toggleMarker(MarkerType marker, bool singleMarker)
@@ -238,9 +276,18 @@ void PhotoManagerWindow::toggleMarker(MarkerType marker, bool singleMarker)
 
 void PhotoManagerWindow::exportCurrentImage()
 {
-	QImage img = imageViewer->currentImage().image();
+	QImage img = imageViewer->currentFrame();
 	if (img.isNull())
 		return;
+	img = imageViewer->rotatedImage(img);
+
+	// Displayed image may be decoded at reduced resolution, export from full resolution
+	const ImageHandle& currentImage = imageViewer->currentImage();
+	if (!currentImage->isFullResolution()) {
+		Image fullImage;
+		if (fullImage.load(currentImage->absoluteFilePath()) && !fullImage.image().isNull())
+			img = imageViewer->rotatedImage(fullImage.image());
+	}
 
 	QString fileName = QFileDialog::getSaveFileName(this, "Export File...", QString());
 	if (fileName.isEmpty())
@@ -255,7 +302,7 @@ void PhotoManagerWindow::exportCurrentImage()
 
 void PhotoManagerWindow::deleteCurrentImage(bool isShiftActive)
 {
-	QString imageFile = imageViewer->currentImage().absoluteFilePath();
+	QString imageFile = imageViewer->currentImage()->absoluteFilePath();
 	if (!imageFile.isEmpty()) {
 		if (isShiftActive) {
 			if (QMessageBox::question(this, "Permanently Delete File", "Do you want to permanently delete current image?", QMessageBox::Yes | QMessageBox::No, QMessageBox::Yes) == QMessageBox::StandardButton::Yes) {
@@ -1,13 +1,15 @@
 #pragma once
 
 #include <QtWidgets/QMainWindow>
+#include <QTimer>
 #include "ui_PhotoManagerWindow.h"
 #include "MarkerType.h"
 #include "Settings.h"
+#include "PrefetchPlanner.h"
+#include "Image.h"
 
 class ImageViewerWidget;
 class ImageProcessor;
-class Image;
 class PermanentStorage;
 class ImageFileList;
 
@@ -26,11 +28,13 @@ protected:
 	void changeEvent(QEvent* event) override;
 
 private slots:
-	void imageLoaded(const Image& image);
+	void imageLoaded(const ImageHandle& image);
 
 private:
 	void nextFile(int multiplier = 1);
 	void previousFile(int multiplier = 1);
+	void navigateToOffset(int offset);
+	void preloadNeighbours(int offset);
 	void toggleMarker(MarkerType marker, bool singleMarker);
 	void exportCurrentImage();
 	void deleteCurrentImage(bool isShiftActive);
@@ -42,4 +46,6 @@ private:
 	ImageProcessor* imageProcessor;
 	ImageFileList* fileList;
 	Settings settings;
+	PrefetchPlanner prefetchPlanner;
+	QTimer prefetchIdleTimer;
 };
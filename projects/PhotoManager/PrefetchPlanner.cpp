@@ -0,0 +1,77 @@
+#include "PrefetchPlanner.h"
+#include <QtMath>
+
+PrefetchPlanner::PrefetchPlanner()
+{
+	plannerTimer.start();
+}
+
+void PrefetchPlanner::recordNavigation(int offset)
+{
+	if (offset == 0)
+		return;
+
+	navigationTimes.append(plannerTimer.elapsed());
+	navigationOffsets.append(offset);
+	if (navigationTimes.count() > HistorySize) {
+		navigationTimes.removeFirst();
+		navigationOffsets.removeFirst();
+	}
+}
+
+PrefetchPlanner::Plan PrefetchPlanner::plan(int cacheCapacity) const
+{
+	// How long ahead should the preloaded images last at current speed
+	static const double LookAheadSeconds = 1.5;
+	static const int MaxAheadCount = 16;
+
+	Plan result;
+	if (navigationOffsets.isEmpty())
+		return result;
+
+	const int lastOffset = navigationOffsets.last();
+	result.direction = (lastOffset > 0) ? 1 : -1;
+	result.stepSize = qAbs(lastOffset);
+
+	const double rate = navigationRate();
+	if (rate <= 0) {
+		// Idle, there is time to fill both directions
+		result.aheadCount = 3;
+		result.behindCount = 2;
+	} else {
+		result.aheadCount = 2 + qCeil(rate * LookAheadSeconds);
+		result.behindCount = (rate > 3) ? 0 : 1;
+	}
+
+	// Keep current image and all planned images in cache at once
+	int available = qMax(0, cacheCapacity - 1);
+	result.aheadCount = qBound(0, result.aheadCount, qMin(MaxAheadCount, available));
+	result.behindCount = qBound(0, result.behindCount, available - result.aheadCount);
+	return result;
+}
+
+double PrefetchPlanner::navigationRate() const
+{
+	// Navigation is considered finished when no key was pressed for this long
+	static const qint64 IdleTimeout = 1000;
+
+	if (navigationTimes.count() < 2)
+		return 0;
+
+	const qint64 now = plannerTimer.elapsed();
+	if (now - navigationTimes.last() > IdleTimeout)
+		return 0;
+
+	// Use only recent events in the same direction
+	const bool forward = (navigationOffsets.last() > 0);
+	int first = navigationTimes.count() - 1;
+	while (first > 0 && (navigationOffsets.at(first - 1) > 0) == forward && navigationTimes.at(first) - navigationTimes.at(first - 1) <= IdleTimeout)
+		first--;
+
+	const int intervals = navigationTimes.count() - 1 - first;
+	if (intervals == 0)
+		return 0;
+
+	const qint64 duration = qMax<qint64>(1, navigationTimes.last() - navigationTimes.at(first));
+	return intervals * 1000.0 / duration;
+}
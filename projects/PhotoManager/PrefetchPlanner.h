@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QVector>
+#include <QElapsedTimer>
+
+// Tracks speed and direction of navigation between images and decides which neighbours should be preloaded
+class PrefetchPlanner
+{
+public:
+	struct Plan
+	{
+		int direction = 1;    // Direction of travel, 1 or -1
+		int stepSize = 1;     // Offset between images when navigating in direction of travel
+		int aheadCount = 1;   // Number of images to preload in direction of travel
+		int behindCount = 1;  // Number of images to preload in opposite direction (single steps)
+	};
+
+	PrefetchPlanner();
+
+	// Register navigation by offset passed to ImageFileList::fileAtOffset
+	void recordNavigation(int offset);
+
+	// Returns preload window for current navigation speed. Cache capacity is number of images the cache can hold.
+	Plan plan(int cacheCapacity) const;
+
+	// Returns navigation speed in images per second, zero when user stopped navigating
+	double navigationRate() const;
+
+private:
+	static const int HistorySize = 6;
+
+	QElapsedTimer plannerTimer;
+	QVector<qint64> navigationTimes;
+	QVector<int> navigationOffsets;
+};
@@ -1,5 +1,26 @@
 #include "PhotoManagerWindow.h"
 #include <QtWidgets/QApplication>
+#include <QTextStream>
+#include <cstdio>
+#include "ImageScaler.h"
+#include "ImageFormatRegistry.h"
+#include "JpegHandler.h"
+
+#ifdef Q_OS_WIN
+#include <qt_windows.h>
+#endif
+
+// Benchmark results go to standard output. Application is built for the GUI subsystem and has no console of its own,
+// console of the command prompt it was started from is attached.
+static QTextStream& benchmarkOutput()
+{
+#ifdef Q_OS_WIN
+	if (AttachConsole(ATTACH_PARENT_PROCESS))
+		freopen("CONOUT$", "w", stdout);
+#endif
+	static QTextStream out(stdout);
+	return out;
+}
 
 int main(int argc, char *argv[])
 {
@@ -8,6 +29,27 @@ int main(int argc, char *argv[])
 	QStringList files = QApplication::arguments();
 	files.removeFirst();
 
+	// Compare downscaling kernel with QImage::scaled on given files
+	if (!files.isEmpty() && files.first() == "--benchmark-scaler") {
+		files.removeFirst();
+		ImageScaler::benchmark(files, benchmarkOutput());
+		return 0;
+	}
+
+	// Compare decoder dispatch by file signature with probing decoders in turn
+	if (!files.isEmpty() && files.first() == "--benchmark-dispatch") {
+		files.removeFirst();
+		ImageFormatRegistry::benchmark(files, benchmarkOutput());
+		return 0;
+	}
+
+	// Compare serial and parallel decoding of large JPEGs with restart markers
+	if (!files.isEmpty() && files.first() == "--benchmark-jpeg") {
+		files.removeFirst();
+		JpegHandler::benchmark(files, benchmarkOutput());
+		return 0;
+	}
+
 	PhotoManagerWindow w(files);
 	w.show();
 	return a.exec();